@@ -0,0 +1,93 @@
+#include "BVH.hpp"
+
+#include <stdexcept>
+#include <string>
+
+void BVH::build(std::vector< Box > const &boxes_) {
+	boxes = boxes_;
+	nodes.clear();
+	items.resize(boxes.size());
+	for (uint32_t i = 0; i < items.size(); ++i) {
+		items[i] = i;
+	}
+	leaf_of.assign(boxes.size(), 0);
+	if (!boxes.empty()) {
+		nodes.reserve(2 * (boxes.size() / LeafSize + 1));
+		build_node(0, uint32_t(items.size()), NoParent);
+	}
+	dirty.assign(nodes.size(), 0);
+	any_dirty = false;
+}
+
+uint32_t BVH::build_node(uint32_t begin, uint32_t end, uint32_t parent) {
+	uint32_t n = uint32_t(nodes.size());
+	nodes.emplace_back();
+	nodes[n].parent = parent;
+
+	Box box;
+	Box centers; //(bounds of the box centers, for picking a split)
+	for (uint32_t i = begin; i < end; ++i) {
+		Box const &b = boxes[items[i]];
+		box.add(b);
+		glm::vec3 center = 0.5f * (b.min + b.max);
+		centers.add(Box{ center, center });
+	}
+	nodes[n].box = box;
+
+	if (end - begin <= LeafSize) {
+		nodes[n].first = begin;
+		nodes[n].count = end - begin;
+		for (uint32_t i = begin; i < end; ++i) {
+			leaf_of[items[i]] = n;
+		}
+		return n;
+	}
+
+	//split at the median along the axis the centers are most spread out along:
+	glm::vec3 extent = centers.max - centers.min;
+	uint32_t axis = 0;
+	if (extent.y > extent[axis]) axis = 1;
+	if (extent.z > extent[axis]) axis = 2;
+	uint32_t mid = begin + (end - begin) / 2;
+	std::nth_element(items.begin() + begin, items.begin() + mid, items.begin() + end, [&](uint32_t a, uint32_t b){
+		return boxes[a].min[axis] + boxes[a].max[axis] < boxes[b].min[axis] + boxes[b].max[axis];
+	});
+
+	build_node(begin, mid, n); //(lands at n + 1)
+	uint32_t second = build_node(mid, end, n);
+	nodes[n].first = second;
+	nodes[n].count = 0;
+	return n;
+}
+
+void BVH::update(uint32_t item, Box const &box) {
+	if (item >= boxes.size()) {
+		throw std::runtime_error("BVH doesn't contain item " + std::to_string(item) + ".");
+	}
+	boxes[item] = box;
+	dirty[leaf_of[item]] = 1;
+	any_dirty = true;
+}
+
+void BVH::refit() {
+	if (!any_dirty) return;
+	//children come after their parents, so going backward handles every child before its parent:
+	for (uint32_t n = uint32_t(nodes.size()); n-- > 0; ) {
+		if (!dirty[n]) continue;
+		dirty[n] = 0;
+		Node &node = nodes[n];
+		Box box;
+		if (node.count > 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				box.add(boxes[items[i]]);
+			}
+		} else {
+			box.add(nodes[n + 1].box);
+			box.add(nodes[node.first].box);
+		}
+		if (box.min == node.box.min && box.max == node.box.max) continue; //(ancestors don't need to change)
+		node.box = box;
+		if (node.parent != NoParent) dirty[node.parent] = 1;
+	}
+	any_dirty = false;
+}
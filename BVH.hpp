@@ -0,0 +1,212 @@
+#pragma once
+
+/*
+ * BVH is a bounding volume hierarchy over (index-numbered) axis-aligned
+ *  boxes, for finding which of many boxes a view, a ray, a sphere, or
+ *  another box touches without looking at all of them.
+ *
+ * It is built once over every box, then kept up to date as boxes move by
+ *  refitting (growing/shrinking the existing nodes) rather than rebuilding;
+ *  that stays fast as long as things don't move too far from where they
+ *  started, which is true of (e.g.) a city with some players walking in it:
+
+	BVH bvh;
+	bvh.build(boxes); //items are boxes[0], boxes[1], ...
+	bvh.update(item, new_box); //...as many as moved...
+	bvh.refit(); //...then once before querying
+	bvh.query_sphere(center, radius, [&](uint32_t item){
+		//item's box touches the sphere
+	});
+
+ * Scene keeps one over its drawables (see Scene::build_bvh), and Movement
+ *  keeps one over the buildings.
+ */
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+struct BVH {
+	struct Box {
+		//(the default box is empty)
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		void add(Box const &other) {
+			min = glm::min(min, other.min);
+			max = glm::max(max, other.max);
+		}
+		bool overlaps(Box const &other) const {
+			return min.x <= other.max.x && other.min.x <= max.x
+			    && min.y <= other.max.y && other.min.y <= max.y
+			    && min.z <= other.max.z && other.min.z <= max.z;
+		}
+	};
+
+	//(re)build over items 0 .. boxes.size()-1:
+	void build(std::vector< Box > const &boxes);
+
+	//change an item's box; queries see the change after the next refit():
+	void update(uint32_t item, Box const &box);
+	//bring every node that holds an updated item (and their ancestors) up to date:
+	void refit();
+
+	//call 'fn(item)' for each item whose box overlaps 'box':
+	template< typename F >
+	void query_box(Box const &box, F const &fn) const;
+
+	//call 'fn(item)' for each item whose box is within 'radius' of 'center':
+	template< typename F >
+	void query_sphere(glm::vec3 const &center, float radius, F const &fn) const;
+
+	//call 'fn(item)' for each item whose box might be visible through 'world_to_clip':
+	// (conservative: a box is skipped only if all its corners are outside the same side of the view volume)
+	template< typename F >
+	void query_frustum(glm::mat4 const &world_to_clip, F const &fn) const;
+
+	//call 'fn(item, t)' for each item whose box is hit by the ray 'origin + t * direction' for some t in [0, max_t]:
+	// ('t' is where the ray enters the box; items come in no particular order)
+	template< typename F >
+	void query_ray(glm::vec3 const &origin, glm::vec3 const &direction, float max_t, F const &fn) const;
+
+	//-- internals ---
+	static constexpr uint32_t LeafSize = 4; //most items in a leaf
+	static constexpr uint32_t NoParent = -1U;
+
+	//nodes are stored depth-first, so an interior node's first child is right after it and every node comes after its parent:
+	struct Node {
+		Box box;
+		uint32_t first = 0; //leaf: first index in 'items'; interior: index of second child
+		uint32_t count = 0; //leaf: how many items (> 0); interior: 0
+		uint32_t parent = NoParent;
+	};
+	std::vector< Node > nodes;
+	std::vector< uint32_t > items; //item numbers, grouped by leaf
+	std::vector< Box > boxes; //each item's box
+	std::vector< uint32_t > leaf_of; //index in 'nodes' of each item's leaf
+	std::vector< uint8_t > dirty; //nodes whose box needs recomputing (set by update, cleared by refit)
+	bool any_dirty = false;
+
+	//build the subtree holding items[begin, end), returning its index in 'nodes':
+	uint32_t build_node(uint32_t begin, uint32_t end, uint32_t parent);
+
+	//what 'visit(node)' returns for each node:
+	enum Visit { Skip, Descend, All };
+	//walk the tree, calling 'fn(item)' for every item in a node that 'visit' says All to, and checking items of leaves it says Descend to with 'check(item)':
+	template< typename V, typename C, typename F >
+	void walk(V const &visit, C const &check, F const &fn) const;
+};
+
+template< typename V, typename C, typename F >
+void BVH::walk(V const &visit, C const &check, F const &fn) const {
+	if (nodes.empty()) return;
+	//(depth-first, with an explicit stack; entries are (node, everything-under-it-passes))
+	uint32_t stack[64];
+	bool stack_all[64];
+	uint32_t top = 0;
+	stack[top] = 0;
+	stack_all[top] = false;
+	top += 1;
+	while (top > 0) {
+		top -= 1;
+		uint32_t n = stack[top];
+		bool all = stack_all[top];
+		Node const &node = nodes[n];
+		if (!all) {
+			Visit v = visit(node.box);
+			if (v == Skip) continue;
+			all = (v == All);
+		}
+		if (node.count > 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+				if (all || check(items[i])) fn(items[i]);
+			}
+		} else {
+			//(the tree is built by splitting in half, so it is never anywhere near this deep)
+			stack[top] = node.first;
+			stack_all[top] = all;
+			top += 1;
+			stack[top] = n + 1;
+			stack_all[top] = all;
+			top += 1;
+		}
+	}
+}
+
+template< typename F >
+void BVH::query_box(Box const &box, F const &fn) const {
+	walk(
+		[&](Box const &b){ return b.overlaps(box) ? Descend : Skip; },
+		[&](uint32_t item){ return boxes[item].overlaps(box); },
+		fn
+	);
+}
+
+template< typename F >
+void BVH::query_sphere(glm::vec3 const &center, float radius, F const &fn) const {
+	float radius2 = radius * radius;
+	auto touches = [&](Box const &b) {
+		glm::vec3 to = glm::clamp(center, b.min, b.max) - center;
+		return glm::dot(to, to) <= radius2;
+	};
+	walk(
+		[&](Box const &b){ return touches(b) ? Descend : Skip; },
+		[&](uint32_t item){ return touches(boxes[item]); },
+		fn
+	);
+}
+
+template< typename F >
+void BVH::query_frustum(glm::mat4 const &world_to_clip, F const &fn) const {
+	//which sides of the view volume all corners of 'b' are outside of (any -> can't be visible) and whether all are inside:
+	auto classify = [&](Box const &b) {
+		uint32_t outside_all = 0x3f;
+		uint32_t outside_any = 0;
+		for (uint32_t c = 0; c < 8; ++c) {
+			glm::vec4 p = world_to_clip * glm::vec4(
+				(c & 1 ? b.max.x : b.min.x),
+				(c & 2 ? b.max.y : b.min.y),
+				(c & 4 ? b.max.z : b.min.z),
+				1.0f
+			);
+			uint32_t outside = 0;
+			if (p.x < -p.w) outside |= 0x01;
+			if (p.x >  p.w) outside |= 0x02;
+			if (p.y < -p.w) outside |= 0x04;
+			if (p.y >  p.w) outside |= 0x08;
+			if (p.z < -p.w) outside |= 0x10;
+			if (p.z >  p.w) outside |= 0x20;
+			outside_all &= outside;
+			outside_any |= outside;
+		}
+		if (outside_all != 0) return Skip;
+		return (outside_any == 0 ? All : Descend); //(a node entirely in view needs no more tests below it)
+	};
+	walk(
+		classify,
+		[&](uint32_t item){ return classify(boxes[item]) != Skip; },
+		fn
+	);
+}
+
+template< typename F >
+void BVH::query_ray(glm::vec3 const &origin, glm::vec3 const &direction, float max_t, F const &fn) const {
+	glm::vec3 inv = 1.0f / direction; //(infinite along axes the ray doesn't move along, which the slab test handles)
+	//where the ray enters 'b' (or a negative number if it misses):
+	auto enter = [&](Box const &b) {
+		glm::vec3 t0 = (b.min - origin) * inv;
+		glm::vec3 t1 = (b.max - origin) * inv;
+		glm::vec3 lo = glm::min(t0, t1);
+		glm::vec3 hi = glm::max(t0, t1);
+		float t_in = std::max(0.0f, std::max(lo.x, std::max(lo.y, lo.z)));
+		float t_out = std::min(max_t, std::min(hi.x, std::min(hi.y, hi.z)));
+		return (t_in <= t_out ? t_in : -1.0f);
+	};
+	walk(
+		[&](Box const &b){ return enter(b) >= 0.0f ? Descend : Skip; },
+		[&](uint32_t item){ return enter(boxes[item]) >= 0.0f; },
+		[&](uint32_t item){ fn(item, enter(boxes[item])); }
+	);
+}
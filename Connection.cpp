@@ -20,11 +20,17 @@ typedef int ssize_t;
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
 #include <unistd.h>
 #include <netdb.h>
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <fcntl.h>
+#endif
+
 #define closesocket close
 
 #endif
@@ -52,8 +58,233 @@ void Connection::close() {
 	}
 }
 
+size_t Connection::pending_spans(RingBuffer::Span *spans, size_t max) const {
+	size_t count = 0;
+	size_t offset = 0; //next send_buffer byte to gather
+
+	//gather send_buffer bytes up to (but not including) 'end':
+	auto gather_send_buffer = [&](size_t end) {
+		while (offset < end && count < max) {
+			RingBuffer::Span span = send_buffer.front_span(offset);
+			span.size = std::min(span.size, end - offset);
+			spans[count++] = span;
+			offset += span.size;
+		}
+	};
+
+	for (size_t i = 0; i < shared_sends.size() && count < max; ++i) {
+		SharedSend const &shared = shared_sends[i];
+		gather_send_buffer(size_t(shared.after - send_buffer_sent));
+		if (count == max) break;
+		size_t skip = (i == 0 ? shared_sent : 0);
+		spans[count].data = shared.data->data() + skip;
+		spans[count].size = shared.data->size() - skip;
+		++count;
+	}
+	gather_send_buffer(send_buffer.size());
+
+	return count;
+}
+
+void Connection::sent(size_t bytes) {
+	while (bytes > 0) {
+		//bytes of send_buffer that go out before the next shared send:
+		size_t before = (shared_sends.empty() ? send_buffer.size() : size_t(shared_sends.front().after - send_buffer_sent));
+		if (before > 0 || shared_sends.empty()) {
+			size_t step = std::min(bytes, before);
+			if (step == 0) throw std::runtime_error("Connection::sent past end of pending data.");
+			send_buffer.consume(step);
+			send_buffer_sent += step;
+			bytes -= step;
+		} else {
+			SharedSend const &shared = shared_sends.front();
+			size_t step = std::min(bytes, shared.data->size() - shared_sent);
+			shared_sent += step;
+			shared_bytes -= step;
+			bytes -= step;
+			if (shared_sent == shared.data->size()) {
+				shared_sends.pop_front();
+				shared_sent = 0;
+			}
+		}
+	}
+}
+
 //---------------------------------
-//Polling helper used by both server and client:
+
+//send as much pending data (send_buffer plus shared sends) as one call will take:
+// returns what the underlying send call returned; 'attempted' is set to the number of bytes offered.
+static ssize_t send_pending(Connection &c, size_t *attempted) {
+	constexpr size_t MaxSpans = 16;
+	RingBuffer::Span spans[MaxSpans];
+	size_t count = c.pending_spans(spans, MaxSpans);
+	assert(count > 0);
+
+	#ifdef _WIN32
+	//(no sendmsg() on windows, so just send the first piece)
+	*attempted = spans[0].size;
+	return send(c.socket, spans[0].data, int(spans[0].size), MSG_DONTWAIT);
+	#else
+	struct iovec iov[MaxSpans];
+	*attempted = 0;
+	for (size_t i = 0; i < count; ++i) {
+		iov[i].iov_base = const_cast< char * >(spans[i].data);
+		iov[i].iov_len = spans[i].size;
+		*attempted += spans[i].size;
+	}
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+	return sendmsg(c.socket, &msg, MSG_DONTWAIT);
+	#endif
+}
+
+//---------------------------------
+#ifdef __linux__
+//(linux) register a socket with an epoll instance for edge-triggered read/write notification:
+// 'ptr' is handed back in the event's data (nullptr is used for the listen socket)
+static void epoll_register(int epoll_fd, Socket socket, void *ptr) {
+	struct epoll_event evt;
+	memset(&evt, 0, sizeof(evt));
+	evt.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	evt.data.ptr = ptr;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket, &evt) != 0) {
+		throw std::system_error(errno, std::system_category(), "failed to add socket to epoll set");
+	}
+}
+
+//(linux) send as much of a connection's pending data as the socket will take:
+// (n.b. closing a socket also removes it from the epoll set, so there is no explicit de-registration)
+static void flush_connection(char const *where, Connection &c, std::function< void(Connection *, Connection::Event event) > const &on_event) {
+	while (c.socket != InvalidSocket && c.writable && c.sending()) {
+		//(pending data may be in more pieces than one call gathers, in which case the loop sends the rest)
+		size_t attempted = 0;
+		ssize_t ret = send_pending(c, &attempted);
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			//~no problem~, but wait for the next EPOLLOUT edge before trying again
+			c.writable = false;
+		} else if (ret <= 0 || ret > (ssize_t)attempted) {
+			if (ret < 0) {
+				std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
+			} else { assert(ret == 0 || ret > (ssize_t)attempted);
+				std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << attempted << "], disconnecting." << std::endl;
+			}
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+		} else { //ret seems reasonable
+			c.sent(ret);
+		}
+	}
+}
+
+//Polling helper used by both server and client (epoll version):
+// sockets were registered with epoll_fd when they were accepted/connected, so each call
+// only touches sockets that actually reported activity (plus a flush of pending sends).
+void poll_connections(
+	char const *where,
+	int epoll_fd,
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	double timeout,
+	Socket listen_socket = InvalidSocket) {
+
+	//send anything queued since the last poll on sockets already known to be writable:
+	// (edge-triggered epoll won't report them again, so waiting first could delay these sends by 'timeout')
+	for (auto &c : connections) {
+		flush_connection(where, c, on_event);
+	}
+
+	constexpr int MaxEvents = 64;
+	struct epoll_event events[MaxEvents];
+
+	//wait (until timeout) for sockets' data to become available:
+	int count = epoll_wait(epoll_fd, events, MaxEvents, int(std::lround(timeout * 1000.0)));
+	if (count < 0) {
+		if (errno != EINTR) {
+			std::cerr << "[" << where << "] epoll_wait returned error " << errno << " (" << strerror(errno) << ")." << std::endl;
+		}
+		return;
+	}
+
+	const uint32_t BufferSize = 20000;
+
+	for (int i = 0; i < count; ++i) {
+		struct epoll_event const &evt = events[i];
+
+		//add new connections as needed:
+		if (evt.data.ptr == nullptr) {
+			assert(listen_socket != InvalidSocket);
+			//edge-triggered, so accept everything that is waiting:
+			while (true) {
+				Socket got = accept(listen_socket, NULL, NULL);
+				if (got == InvalidSocket) break; //(EAGAIN, or oh well)
+				connections.emplace_back();
+				connections.back().socket = got;
+				try {
+					epoll_register(epoll_fd, got, &connections.back());
+				} catch (std::system_error &e) {
+					std::cerr << "[" << where << "] " << e.what() << "; dropping client." << std::endl;
+					connections.back().close();
+					continue;
+				}
+				std::cerr << "[" << where << "] client connected on " << connections.back().socket << "." << std::endl; //INFO
+				if (on_event) on_event(&connections.back(), Connection::OnOpen);
+			}
+			continue;
+		}
+
+		Connection &c = *reinterpret_cast< Connection * >(evt.data.ptr);
+		if (c.socket == InvalidSocket) continue; //(closed earlier this poll)
+
+		if (evt.events & EPOLLOUT) {
+			c.writable = true;
+		}
+
+		if (evt.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			//edge-triggered, so read until the socket would block:
+			bool got_data = false;
+			while (c.socket != InvalidSocket) {
+				//receive directly into free space at the back of recv_buffer:
+				RingBuffer::Space space = c.recv_buffer.back_space(BufferSize);
+				ssize_t ret = recv(c.socket, space.data, space.size, MSG_DONTWAIT);
+				if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					//~no problem~ but no more data
+					break;
+				} else if (ret <= 0 || ret > (ssize_t)space.size) {
+					//~problem~ so remove connection
+					if (ret == 0) {
+						std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
+					} else if (ret < 0) {
+						std::cerr << "[" << where << "] recv() returned error " << errno << "(" << strerror(errno) << "), disconnecting." << std::endl;
+					} else {
+						std::cerr << "[" << where << "] recv() returned strange number of bytes, disconnecting." << std::endl;
+					}
+					//let the callback see any data that arrived before the close:
+					if (got_data && on_event) on_event(&c, Connection::OnRecv);
+					got_data = false;
+					if (c.socket != InvalidSocket) {
+						c.close();
+						if (on_event) on_event(&c, Connection::OnClose);
+					}
+				} else { //ret > 0
+					c.recv_buffer.commit(ret);
+					got_data = true;
+				}
+			}
+			if (got_data && on_event) on_event(&c, Connection::OnRecv);
+		}
+	}
+
+	//process responses (including anything queued by the callbacks above):
+	for (auto &c : connections) {
+		flush_connection(where, c, on_event);
+	}
+}
+
+#else
+
+//Polling helper used by both server and client (select version):
 void poll_connections(
 	char const *where,
 	std::list< Connection > &connections,
@@ -78,7 +309,7 @@ void poll_connections(
 		if (c.socket != InvalidSocket) {
 			max = std::max(max, int(c.socket));
 			FD_SET(c.socket, &read_fds);
-			if (!c.send_buffer.empty()) {
+			if (c.sending()) {
 				FD_SET(c.socket, &write_fds);
 			}
 		}
@@ -142,7 +373,7 @@ void poll_connections(
 			c.close();
 			if (on_event) on_event(&c, Connection::OnClose);
 		} else { //ret > 0
-			c.recv_buffer.insert(c.recv_buffer.end(), buffer, buffer + ret);
+			c.recv_buffer.append(buffer, ret);
 			if (on_event) on_event(&c, Connection::OnRecv);
 		}
 	}
@@ -150,31 +381,30 @@ void poll_connections(
 	//process responses:
 	for (auto &c : connections) {
 		//don't bother with connections unless they are valid, have something to send, and are marked writable:
-		if (c.socket == InvalidSocket || c.send_buffer.empty() || !FD_ISSET(c.socket, &write_fds)) continue;
+		if (c.socket == InvalidSocket || !c.sending() || !FD_ISSET(c.socket, &write_fds)) continue;
 		
-		#ifdef _WIN32
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), int(c.send_buffer.size()), MSG_DONTWAIT);
-		#else
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), c.send_buffer.size(), MSG_DONTWAIT);
-		#endif 
+		//(if pending data is in more pieces than one call gathers, the rest is sent next poll)
+		size_t attempted = 0;
+		ssize_t ret = send_pending(c, &attempted);
 		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
 			//~no problem~, but don't keep trying
 			break;
-		} else if (ret <= 0 || ret > (ssize_t)c.send_buffer.size()) {
+		} else if (ret <= 0 || ret > (ssize_t)attempted) {
 			if (ret < 0) {
 				std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
-			} else { assert(ret == 0 || ret > (ssize_t)c.send_buffer.size());
-				std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << c.send_buffer.size() << "], disconnecting." << std::endl;
+			} else { assert(ret == 0 || ret > (ssize_t)attempted);
+				std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << attempted << "], disconnecting." << std::endl;
 			}
 			c.close();
 			if (on_event) on_event(&c, Connection::OnClose);
 		} else { //ret seems reasonable
-			c.send_buffer.erase(c.send_buffer.begin(), c.send_buffer.begin() + ret);
+			c.sent(ret);
 		}
 	}
 
 		
 }
+#endif
 
 //---------------------------------
 
@@ -261,16 +491,92 @@ Server::Server(std::string const &port) {
 	}
 
 	{ //listen on socket
-		int ret = ::listen(listen_socket, 5);
+		//(a short backlog drops connection attempts when many clients connect at once)
+		int ret = ::listen(listen_socket, SOMAXCONN);
 		if (ret < 0) {
 			closesocket(listen_socket);
 			throw std::system_error(errno, std::system_category(), "failed to listen on socket");
 		}
 	}
+
+	#ifdef __linux__
+	{ //register listen socket with a new epoll instance:
+		//listen socket must be non-blocking so that the edge-triggered accept loop can drain it:
+		int flags = fcntl(listen_socket, F_GETFL, 0);
+		if (flags < 0 || fcntl(listen_socket, F_SETFL, flags | O_NONBLOCK) < 0) {
+			throw std::system_error(errno, std::system_category(), "failed to make listen socket non-blocking");
+		}
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0) {
+			throw std::system_error(errno, std::system_category(), "failed to create epoll instance");
+		}
+		epoll_register(epoll_fd, listen_socket, nullptr);
+	}
+	#endif
+}
+
+Server::Server() {
+	#ifdef _WIN32
+	{ //init winsock:
+		WSADATA info;
+		if (WSAStartup((2 << 8) | 2, &info) != 0) {
+			throw std::runtime_error("WSAStartup failed.");
+		}
+	}
+	#endif
+
+	#ifdef __linux__
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		throw std::system_error(errno, std::system_category(), "failed to create epoll instance");
+	}
+	#endif
+}
+
+Server::~Server() {
+	#ifdef __linux__
+	if (epoll_fd != -1) {
+		::close(epoll_fd);
+		epoll_fd = -1;
+	}
+	#endif
+}
+
+Socket Server::release(Connection *connection) {
+	Socket socket = connection->socket;
+	if (socket == InvalidSocket) return InvalidSocket;
+	#ifdef __linux__
+	//(the socket stays open, so it must be removed from this epoll set explicitly)
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, socket, nullptr) != 0) {
+		throw std::system_error(errno, std::system_category(), "failed to remove socket from epoll set");
+	}
+	#endif
+	connection->socket = InvalidSocket; //(reaped like a closed connection)
+	return socket;
+}
+
+Connection *Server::adopt(Socket socket) {
+	connections.emplace_back();
+	connections.back().socket = socket;
+	#ifdef __linux__
+	//(if data is already waiting, registering reports it on the next poll)
+	try {
+		epoll_register(epoll_fd, socket, &connections.back());
+	} catch (...) {
+		connections.back().close();
+		connections.pop_back();
+		throw;
+	}
+	#endif
+	return &connections.back();
 }
 
 void Server::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
+	#ifdef __linux__
+	poll_connections("Server::poll", epoll_fd, connections, on_event, timeout, listen_socket);
+	#else
 	poll_connections("Server::poll", connections, on_event, timeout, listen_socket);
+	#endif
 
 	//reap closed clients:
 	for (auto connection = connections.begin(); connection != connections.end(); /*later*/) {
@@ -347,10 +653,33 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 			throw std::runtime_error("Failed to connect to any of the addresses tried for server.");
 		}
 	}
+
+	#ifdef __linux__
+	{ //register connection with a new epoll instance:
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0) {
+			throw std::system_error(errno, std::system_category(), "failed to create epoll instance");
+		}
+		epoll_register(epoll_fd, connection.socket, &connection);
+	}
+	#endif
+}
+
+Client::~Client() {
+	#ifdef __linux__
+	if (epoll_fd != -1) {
+		::close(epoll_fd);
+		epoll_fd = -1;
+	}
+	#endif
 }
 
 
 void Client::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
+	#ifdef __linux__
+	poll_connections("Client::poll", epoll_fd, connections, on_event, timeout, InvalidSocket);
+	#else
 	poll_connections("Client::poll", connections, on_event, timeout, InvalidSocket);
+	#endif
 }
 
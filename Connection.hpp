@@ -13,9 +13,10 @@ int main(int argc, char **argv) {
 	while (true) {
 		server.poll([](Connection *connection, Connection::Event evt){
 			if (evt == Connection::OnRecv) {
-				//extract and erase data from the connection's recv_buffer:
-				std::vector< uint8_t > data = connection->recv_buffer;
-				connection->recv_buffer.clear();
+				//extract and consume data from the connection's recv_buffer:
+				std::vector< uint8_t > data(connection->recv_buffer.size());
+				connection->recv_buffer.peek(0, data.data(), data.size());
+				connection->recv_buffer.consume(data.size());
 				//send to other connections:
 
 			}
@@ -60,8 +61,12 @@ int main(int argc, char **argv) {
 #endif
 //--------- ---------------------------------- ---------
 
+#include "RingBuffer.hpp"
+
 #include <vector>
 #include <list>
+#include <deque>
+#include <memory>
 #include <string>
 #include <functional>
 
@@ -74,9 +79,25 @@ struct Connection {
 	}
 	//Helper that will append raw bytes to the send buffer:
 	void send_raw(void const *data, size_t size) {
-		send_buffer.insert(send_buffer.end(), reinterpret_cast< uint8_t const * >(data), reinterpret_cast< uint8_t const * >(data) + size);
+		send_buffer.append(data, size);
+	}
+
+	//Immutable bytes that can be queued on many connections at once (e.g., a broadcast snapshot):
+	typedef std::shared_ptr< std::vector< char > const > SharedData;
+
+	//Queue shared bytes for sending without copying them:
+	// (they go out after everything already sent and before anything sent afterward)
+	void send_shared(SharedData const &data) {
+		if (!data || data->empty()) return;
+		shared_sends.emplace_back(SharedSend{ data, send_buffer_sent + send_buffer.size() });
+		shared_bytes += data->size();
 	}
 
+	//Is there any data (copied or shared) waiting to be sent?
+	bool sending() const { return !send_buffer.empty() || !shared_sends.empty(); }
+	//How many bytes (copied or shared) are waiting to be sent?
+	size_t sending_bytes() const { return send_buffer.size() + shared_bytes; }
+
 	//Call 'close' to mark a connection for discard:
 	void close();
 
@@ -84,12 +105,29 @@ struct Connection {
 	explicit operator bool() { return socket != InvalidSocket; }
 
 	//To send data over a connection, append it to send_buffer:
-	std::vector< char > send_buffer;
+	RingBuffer send_buffer;
 	//When the connection receives data, it is appended to recv_buffer:
-	std::vector< char > recv_buffer;
+	// (peek() at it and consume() whole messages from the front)
+	RingBuffer recv_buffer;
 
 	//internals:
 	Socket socket = InvalidSocket;
+	bool writable = true; //(epoll backend) set on EPOLLOUT edges, cleared when send() would block
+
+	//shared data waiting to be sent, each after a given position in the send_buffer byte stream:
+	struct SharedSend {
+		SharedData data;
+		uint64_t after; //(counted in bytes ever appended to send_buffer)
+	};
+	std::deque< SharedSend > shared_sends;
+	size_t shared_sent = 0; //bytes of shared_sends.front() already sent
+	size_t shared_bytes = 0; //bytes in shared_sends not yet sent
+	uint64_t send_buffer_sent = 0; //bytes ever sent from send_buffer
+
+	//collect (up to 'max') contiguous pieces of pending send data, in order, for a scatter-gather send:
+	size_t pending_spans(RingBuffer::Span *spans, size_t max) const;
+	//discard the first 'bytes' bytes of pending send data (because they were sent):
+	void sent(size_t bytes);
 
 	enum Event {
 		OnOpen,
@@ -100,6 +138,8 @@ struct Connection {
 
 struct Server {
 	Server(std::string const &port); //pass the port number to listen on, as a string (servname, really)
+	Server(); //a server that doesn't listen, and only gets connections via adopt()
+	~Server(); //(closes the epoll instance, on linux)
 
 	//poll() updates the list of active connections and provides information to your callbacks:
 	void poll(
@@ -107,13 +147,26 @@ struct Server {
 		double timeout = 0.0 //timeout (seconds)
 	);
 
+	//For handing connections between servers (e.g., to a server polled by another thread):
+	//release() removes a connection (it is discarded after this poll) but leaves its socket open, and returns the socket:
+	Socket release(Connection *connection);
+	//adopt() starts managing a socket released by another server, and returns its connection:
+	// (no OnOpen is reported for adopted connections)
+	Connection *adopt(Socket socket);
+
 	std::list< Connection > connections;
 	Socket listen_socket = InvalidSocket;
+
+	#ifdef __linux__
+	//on linux, sockets are registered (edge-triggered) with this epoll instance once, on accept:
+	int epoll_fd = -1;
+	#endif
 };
 
 
 struct Client {
 	Client(std::string const &host, std::string const &port);
+	~Client(); //(closes the epoll instance, on linux)
 
 	//poll() checks the status of the active connection and provides information to your callbacks:
 	void poll(
@@ -123,4 +176,9 @@ struct Client {
 
 	std::list< Connection > connections; //will only ever contain exactly one connection
 	Connection &connection; //reference to the only connection in the connections list
+
+	#ifdef __linux__
+	//on linux, the connection is registered (edge-triggered) with this epoll instance once, on connect:
+	int epoll_fd = -1;
+	#endif
 };
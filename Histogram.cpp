@@ -0,0 +1,63 @@
+#include "Histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+constexpr double BucketsPerDoubling = 8.0;
+
+//bucket 0 holds samples under a microsecond, bucket i holds [2^((i-1)/8), 2^(i/8)) microseconds:
+static size_t bucket_index(double seconds) {
+	double us = seconds * 1e6;
+	if (!(us >= 1.0)) return 0;
+	return 1 + size_t(std::floor(std::log2(us) * BucketsPerDoubling));
+}
+static double bucket_upper(size_t index) {
+	return std::exp2(double(index) / BucketsPerDoubling) * 1e-6;
+}
+
+void Histogram::add(double seconds) {
+	size_t index = bucket_index(seconds);
+	if (index >= buckets.size()) buckets.resize(index + 1, 0);
+	buckets[index] += 1;
+	samples += 1;
+	total += seconds;
+	max_value = std::max(max_value, seconds);
+}
+
+void Histogram::clear() {
+	buckets.clear();
+	samples = 0;
+	total = 0.0;
+	max_value = 0.0;
+}
+
+void Histogram::merge(Histogram const &other) {
+	if (other.buckets.size() > buckets.size()) buckets.resize(other.buckets.size(), 0);
+	for (size_t i = 0; i < other.buckets.size(); ++i) {
+		buckets[i] += other.buckets[i];
+	}
+	samples += other.samples;
+	total += other.total;
+	max_value = std::max(max_value, other.max_value);
+}
+
+double Histogram::percentile(double p) const {
+	if (samples == 0) return 0.0;
+	//rank of the requested sample (1-based):
+	size_t rank = size_t(std::ceil(std::clamp(p, 0.0, 1.0) * double(samples)));
+	rank = std::max< size_t >(rank, 1);
+	size_t seen = 0;
+	for (size_t i = 0; i < buckets.size(); ++i) {
+		seen += buckets[i];
+		if (seen >= rank) return std::min(bucket_upper(i), max_value);
+	}
+	return max_value;
+}
+
+std::string Histogram::summary_ms() const {
+	char buffer[128];
+	std::snprintf(buffer, sizeof(buffer), "p50 %.2fms p99 %.2fms max %.2fms",
+		percentile(0.5) * 1e3, percentile(0.99) * 1e3, max() * 1e3);
+	return buffer;
+}
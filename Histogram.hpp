@@ -0,0 +1,43 @@
+#pragma once
+
+/*
+ * Histogram collects timing samples (in seconds) into logarithmic buckets --
+ *  eight per doubling, starting at one microsecond -- so percentiles can be
+ *  reported (to within about 9%) without keeping every sample around:
+
+	Histogram rtt;
+	rtt.add(0.0123);
+	std::cout << rtt.summary_ms() << std::endl; //"p50 12.3ms p99 12.3ms max 12.3ms"
+
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct Histogram {
+	//record a sample:
+	void add(double seconds);
+	//forget all samples:
+	void clear();
+	//add another histogram's samples to this one:
+	void merge(Histogram const &other);
+
+	size_t count() const { return samples; }
+	double mean() const { return (samples ? total / double(samples) : 0.0); }
+	double max() const { return max_value; }
+
+	//value that fraction 'p' (in [0,1]) of the samples are at or below:
+	// (actually the upper edge of the bucket holding that sample, clamped to max())
+	double percentile(double p) const;
+
+	//short human-readable summary like "p50 1.23ms p99 4.56ms max 7.89ms":
+	std::string summary_ms() const;
+
+	//-- internals ---
+	std::vector< uint32_t > buckets;
+	size_t samples = 0;
+	double total = 0.0;
+	double max_value = 0.0;
+};
@@ -4,26 +4,10 @@
 #include "gl_errors.hpp"
 
 Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
+Scene::Drawable::Pipeline lit_color_texture_instanced_program_pipeline;
 
-Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
-	LitColorTextureProgram *ret = new LitColorTextureProgram();
-
-	//----- build the pipeline template -----
-	lit_color_texture_program_pipeline.program = ret->program;
-
-	lit_color_texture_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
-	lit_color_texture_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
-	lit_color_texture_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
-
-	/* This will be used later if/when we build a light loop into the Scene:
-	lit_color_texture_program_pipeline.LIGHT_TYPE_int = ret->LIGHT_TYPE_int;
-	lit_color_texture_program_pipeline.LIGHT_LOCATION_vec3 = ret->LIGHT_LOCATION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_DIRECTION_vec3 = ret->LIGHT_DIRECTION_vec3;
-	lit_color_texture_program_pipeline.LIGHT_ENERGY_vec3 = ret->LIGHT_ENERGY_vec3;
-	lit_color_texture_program_pipeline.LIGHT_CUTOFF_float = ret->LIGHT_CUTOFF_float;
-	*/
-
-	//make a 1-pixel white texture to bind by default:
+//make a 1-pixel white texture to bind by default:
+static GLuint make_white_texture() {
 	GLuint tex;
 	glGenTextures(1, &tex);
 
@@ -36,21 +20,67 @@ Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> L
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glBindTexture(GL_TEXTURE_2D, 0);
 
+	return tex;
+}
+
+Load< LitColorTextureProgram > lit_color_texture_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	LitColorTextureProgram *ret = new LitColorTextureProgram();
+
+	//----- build the pipeline template -----
+	lit_color_texture_program_pipeline.program = ret->program;
+
+	lit_color_texture_program_pipeline.Object_block = ret->Object_block;
 
-	lit_color_texture_program_pipeline.textures[0].texture = tex;
+	//(lighting comes from the Frame block, which Scene::draw fills in from the scene's lights)
+
+	lit_color_texture_program_pipeline.textures[0].texture = make_white_texture();
 	lit_color_texture_program_pipeline.textures[0].target = GL_TEXTURE_2D;
 
 	return ret;
 });
 
-LitColorTextureProgram::LitColorTextureProgram() {
+Load< LitColorTextureProgram > lit_color_texture_instanced_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
+	LitColorTextureProgram *ret = new LitColorTextureProgram(true);
+
+	//----- build the pipeline template -----
+	lit_color_texture_instanced_program_pipeline.program = ret->program;
+
+	lit_color_texture_instanced_program_pipeline.InstanceObjectToClip_mat4 = ret->InstanceObjectToClip_mat4;
+	lit_color_texture_instanced_program_pipeline.InstanceObjectToLight_mat4x3 = ret->InstanceObjectToLight_mat4x3;
+	lit_color_texture_instanced_program_pipeline.InstanceNormalToLight_mat3 = ret->InstanceNormalToLight_mat3;
+	lit_color_texture_instanced_program_pipeline.InstanceLightIndices_uvec2 = ret->InstanceLightIndices_uvec2;
+
+	lit_color_texture_instanced_program_pipeline.textures[0].texture = make_white_texture();
+	lit_color_texture_instanced_program_pipeline.textures[0].target = GL_TEXTURE_2D;
+
+	return ret;
+});
+
+LitColorTextureProgram::LitColorTextureProgram(bool instanced) {
+	//the instanced variant gets its transforms (and lights) from per-instance attributes (the rest of the shader refers to them by the uniforms' names):
+	std::string transforms = instanced ?
+		"in mat4 InstanceObjectToClip;\n"
+		"in mat4x3 InstanceObjectToLight;\n"
+		"in mat3 InstanceNormalToLight;\n"
+		"in uvec2 InstanceLightIndices;\n"
+		"#define OBJECT_TO_CLIP InstanceObjectToClip\n"
+		"#define OBJECT_TO_LIGHT InstanceObjectToLight\n"
+		"#define NORMAL_TO_LIGHT InstanceNormalToLight\n"
+		"#define LIGHT_INDICES InstanceLightIndices\n"
+	:
+		"layout(std140) uniform Object {\n" //(see Scene::ObjectBlock)
+		"	mat4 OBJECT_TO_CLIP;\n"
+		"	mat4x3 OBJECT_TO_LIGHT;\n"
+		"	mat3 NORMAL_TO_LIGHT;\n"
+		"	uvec2 LIGHT_INDICES;\n"
+		"};\n"
+	;
+
 	//Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
 	program = gl_compile_program(
 		//vertex shader:
 		"#version 330\n"
-		"uniform mat4 OBJECT_TO_CLIP;\n"
-		"uniform mat4x3 OBJECT_TO_LIGHT;\n"
-		"uniform mat3 NORMAL_TO_LIGHT;\n"
+		+ transforms +
 		"in vec4 Position;\n"
 		"in vec3 Normal;\n"
 		"in vec4 Color;\n"
@@ -59,48 +89,62 @@ LitColorTextureProgram::LitColorTextureProgram() {
 		"out vec3 normal;\n"
 		"out vec4 color;\n"
 		"out vec2 texCoord;\n"
+		"flat out uvec2 lightIndices;\n"
 		"void main() {\n"
 		"	gl_Position = OBJECT_TO_CLIP * Position;\n"
 		"	position = OBJECT_TO_LIGHT * Position;\n"
 		"	normal = NORMAL_TO_LIGHT * Normal;\n"
 		"	color = Color;\n"
 		"	texCoord = TexCoord;\n"
+		"	lightIndices = LIGHT_INDICES;\n"
 		"}\n"
 	,
 		//fragment shader:
 		"#version 330\n"
 		"uniform sampler2D TEX;\n"
-		"uniform int LIGHT_TYPE;\n"
-		"uniform vec3 LIGHT_LOCATION;\n"
-		"uniform vec3 LIGHT_DIRECTION;\n"
-		"uniform vec3 LIGHT_ENERGY;\n"
-		"uniform float LIGHT_CUTOFF;\n"
+		"struct Light {\n" //(see Scene::LightBlock)
+		"	int TYPE;\n"
+		"	float CUTOFF;\n"
+		"	vec3 LOCATION;\n"
+		"	vec3 DIRECTION;\n"
+		"	vec3 ENERGY;\n"
+		"};\n"
+		"layout(std140) uniform Frame {\n" //(see Scene::FrameBlock)
+		"	Light LIGHTS[" + std::to_string(Scene::MaxLights) + "];\n"
+		"};\n"
 		"in vec3 position;\n"
 		"in vec3 normal;\n"
 		"in vec4 color;\n"
 		"in vec2 texCoord;\n"
+		"flat in uvec2 lightIndices;\n"
 		"out vec4 fragColor;\n"
 		"void main() {\n"
 		"	vec3 n = normalize(normal);\n"
-		"	vec3 e;\n"
-		"	if (LIGHT_TYPE == 0) { //point light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
-		"		float dis2 = dot(l,l);\n"
-		"		l = normalize(l);\n"
-		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 1) { //hemi light \n"
-		"		e = (dot(n,-LIGHT_DIRECTION) * 0.5 + 0.5) * LIGHT_ENERGY;\n"
-		"	} else if (LIGHT_TYPE == 2) { //spot light \n"
-		"		vec3 l = (LIGHT_LOCATION - position);\n"
-		"		float dis2 = dot(l,l);\n"
-		"		l = normalize(l);\n"
-		"		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-		"		float c = dot(l,-LIGHT_DIRECTION);\n"
-		"		nl *= smoothstep(LIGHT_CUTOFF,mix(LIGHT_CUTOFF,1.0,0.1), c);\n"
-		"		e = nl * LIGHT_ENERGY;\n"
-		"	} else { //(LIGHT_TYPE == 3) //directional light \n"
-		"		e = max(0.0, dot(n,-LIGHT_DIRECTION)) * LIGHT_ENERGY;\n"
+		"	vec3 e = vec3(0.0);\n"
+		//only the lights Scene::draw found to reach this object, one index per byte of lightIndices:
+		"	for (uint i = 0u; i < " + std::to_string(Scene::MaxObjectLights) + "u; ++i) {\n"
+		"		uint index = (lightIndices[i / 4u] >> (8u * (i % 4u))) & 0xffu;\n"
+		"		if (index == " + std::to_string(Scene::NoLight) + "u) break;\n"
+		"		Light light = LIGHTS[index];\n"
+		"		if (light.TYPE == 0) { //point light \n"
+		"			vec3 l = (light.LOCATION - position);\n"
+		"			float dis2 = dot(l,l);\n"
+		"			l = normalize(l);\n"
+		"			float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
+		"			e += nl * light.ENERGY;\n"
+		"		} else if (light.TYPE == 1) { //hemi light \n"
+		"			e += (dot(n,-light.DIRECTION) * 0.5 + 0.5) * light.ENERGY;\n"
+		"		} else if (light.TYPE == 2) { //spot light \n"
+		"			vec3 l = (light.LOCATION - position);\n"
+		"			float dis2 = dot(l,l);\n"
+		"			l = normalize(l);\n"
+		"			float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
+		"			float c = dot(l,-light.DIRECTION);\n"
+		"			nl *= smoothstep(light.CUTOFF,mix(light.CUTOFF,1.0,0.1), c);\n"
+		"			e += nl * light.ENERGY;\n"
+		"		} else { //(light.TYPE == 3) //directional light \n"
+		"			e += max(0.0, dot(n,-light.DIRECTION)) * light.ENERGY;\n"
+		"		}\n"
 		"	}\n"
 		"	vec4 albedo = texture(TEX, texCoord) * color;\n"
 		"	fragColor = vec4(e*albedo.rgb, albedo.a);\n"
@@ -115,17 +159,18 @@ LitColorTextureProgram::LitColorTextureProgram() {
 	Color_vec4 = glGetAttribLocation(program, "Color");
 	TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
 
-	//look up the locations of uniforms:
-	OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
-	OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "OBJECT_TO_LIGHT");
-	NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
-
-	LIGHT_TYPE_int = glGetUniformLocation(program, "LIGHT_TYPE");
-	LIGHT_LOCATION_vec3 = glGetUniformLocation(program, "LIGHT_LOCATION");
-	LIGHT_DIRECTION_vec3 = glGetUniformLocation(program, "LIGHT_DIRECTION");
-	LIGHT_ENERGY_vec3 = glGetUniformLocation(program, "LIGHT_ENERGY");
-	LIGHT_CUTOFF_float = glGetUniformLocation(program, "LIGHT_CUTOFF");
-
+	InstanceObjectToClip_mat4 = glGetAttribLocation(program, "InstanceObjectToClip");
+	InstanceObjectToLight_mat4x3 = glGetAttribLocation(program, "InstanceObjectToLight");
+	InstanceNormalToLight_mat3 = glGetAttribLocation(program, "InstanceNormalToLight");
+	InstanceLightIndices_uvec2 = glGetAttribLocation(program, "InstanceLightIndices");
+
+	//look up the indices of uniform blocks, and attach them to the binding points Scene::draw fills in:
+	Frame_block = glGetUniformBlockIndex(program, "Frame");
+	glUniformBlockBinding(program, Frame_block, Scene::FrameBinding);
+	if (!instanced) {
+		Object_block = glGetUniformBlockIndex(program, "Object");
+		glUniformBlockBinding(program, Object_block, Scene::ObjectBinding);
+	}
 
 	GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
 
@@ -5,8 +5,9 @@
 #include "Scene.hpp"
 
 //Shader program that draws transformed, lit, textured vertices tinted with vertex colors:
+// the 'instanced' variant takes its transforms as per-instance attributes instead of uniforms, so Scene::draw can draw many copies of a mesh at once
 struct LitColorTextureProgram {
-	LitColorTextureProgram();
+	LitColorTextureProgram(bool instanced = false);
 	~LitColorTextureProgram();
 
 	GLuint program = 0;
@@ -17,17 +18,15 @@ struct LitColorTextureProgram {
 	GLuint Color_vec4 = -1U;
 	GLuint TexCoord_vec2 = -1U;
 
-	//Uniform (per-invocation variable) locations:
-	GLuint OBJECT_TO_CLIP_mat4 = -1U;
-	GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
-	GLuint NORMAL_TO_LIGHT_mat3 = -1U;
-
-	//lighting:
-	GLuint LIGHT_TYPE_int = -1U;
-	GLuint LIGHT_LOCATION_vec3 = -1U;
-	GLuint LIGHT_DIRECTION_vec3 = -1U;
-	GLuint LIGHT_ENERGY_vec3 = -1U;
-	GLuint LIGHT_CUTOFF_float = -1U;
+	//Per-instance attribute locations (instanced variant only):
+	GLuint InstanceObjectToClip_mat4 = -1U;
+	GLuint InstanceObjectToLight_mat4x3 = -1U;
+	GLuint InstanceNormalToLight_mat3 = -1U;
+	GLuint InstanceLightIndices_uvec2 = -1U;
+
+	//Uniform block indices (the blocks are filled in by Scene::draw -- see Scene::FrameBlock and Scene::ObjectBlock):
+	GLuint Frame_block = -1U; //lights
+	GLuint Object_block = -1U; //transforms and which lights to use (non-instanced variant only)
 	
 	//Textures:
 	//TEXTURE0 - texture that is accessed by TexCoord
@@ -38,3 +37,8 @@ extern Load< LitColorTextureProgram > lit_color_texture_program;
 //For convenient scene-graph setup, copy this object:
 // NOTE: by default, has texture bound to 1-pixel white texture -- so it's okay to use with vertex-color-only meshes.
 extern Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
+
+//The instanced variant, and a pipeline template for it:
+// (meshes drawn with it need vertex arrays made for *this* program; lighting uniforms are set on it separately)
+extern Load< LitColorTextureProgram > lit_color_texture_instanced_program;
+extern Scene::Drawable::Pipeline lit_color_texture_instanced_program_pipeline;
@@ -0,0 +1,108 @@
+#include "MappedChunks.hpp"
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN 1
+#endif
+#undef APIENTRY
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedChunks::MappedChunks(std::string const &filename_) : filename(filename_) {
+	#ifdef _WIN32
+	file_handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file_handle == INVALID_HANDLE_VALUE) {
+		file_handle = nullptr;
+		throw std::runtime_error("Failed to open '" + filename + "'.");
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file_handle, &file_size)) {
+		CloseHandle(file_handle);
+		throw std::runtime_error("Failed to get size of '" + filename + "'.");
+	}
+	size = size_t(file_size.QuadPart);
+	if (size != 0) {
+		mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping_handle) base = reinterpret_cast< uint8_t const * >(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+		if (!base) {
+			if (mapping_handle) CloseHandle(mapping_handle);
+			CloseHandle(file_handle);
+			throw std::runtime_error("Failed to map '" + filename + "'.");
+		}
+	}
+	#else
+	fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1) {
+		throw std::runtime_error("Failed to open '" + filename + "'.");
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		throw std::runtime_error("Failed to get size of '" + filename + "'.");
+	}
+	size = size_t(info.st_size);
+	if (size != 0) {
+		void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped == MAP_FAILED) {
+			close(fd);
+			throw std::runtime_error("Failed to map '" + filename + "'.");
+		}
+		base = reinterpret_cast< uint8_t const * >(mapped);
+	}
+	#endif
+
+	//walk the chunk headers (8 bytes: magic, then native-endian size -- see read_chunk):
+	size_t at = 0;
+	while (at < size) {
+		if (size - at < 8) {
+			unmap();
+			throw std::runtime_error("File '" + filename + "' ends partway through a chunk header.");
+		}
+		Chunk chunk;
+		std::memcpy(chunk.magic, base + at, 4);
+		std::memcpy(&chunk.size, base + at + 4, 4);
+		chunk.offset = at + 8;
+		if (size - chunk.offset < chunk.size) {
+			unmap();
+			throw std::runtime_error("File '" + filename + "' ends partway through its '" + std::string(chunk.magic, 4) + "' chunk.");
+		}
+		chunks.emplace_back(chunk);
+		at = chunk.offset + chunk.size;
+	}
+}
+
+MappedChunks::~MappedChunks() {
+	unmap();
+}
+
+void MappedChunks::unmap() {
+	#ifdef _WIN32
+	if (base) UnmapViewOfFile(base);
+	if (mapping_handle) CloseHandle(mapping_handle);
+	if (file_handle) CloseHandle(file_handle);
+	mapping_handle = nullptr;
+	file_handle = nullptr;
+	#else
+	if (base) munmap(const_cast< uint8_t * >(base), size);
+	if (fd != -1) close(fd);
+	fd = -1;
+	#endif
+	base = nullptr;
+}
+
+MappedChunks::Chunk const *MappedChunks::find(std::string const &magic) const {
+	if (magic.size() != 4) return nullptr;
+	for (auto const &chunk : chunks) {
+		if (std::memcmp(chunk.magic, magic.data(), 4) == 0) return &chunk;
+	}
+	return nullptr;
+}
+
+bool MappedChunks::has(std::string const &magic) const {
+	return find(magic) != nullptr;
+}
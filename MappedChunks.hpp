@@ -0,0 +1,117 @@
+#pragma once
+
+/*
+ * MappedChunks maps a whole chunk file (the format read_chunk / write_chunk
+ *  in read_write_chunk.hpp use) into memory and hands out typed views of
+ *  its chunks, without copying them anywhere first:
+
+	MappedChunks file(data_path("game2-city.pnct"));
+	MappedChunks::Span< Vertex > vertices = file.get< Vertex >("pnct");
+	glBufferData(GL_ARRAY_BUFFER, vertices.size_bytes(), vertices.data(), GL_STATIC_DRAW);
+	Vertex v = vertices[10]; //(throws if out of range)
+
+ * Chunks are found by their magic number, so they can be in any order (if
+ *  a magic number appears more than once, the first one wins).
+ *
+ * Spans are only good as long as the MappedChunks they came from.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+struct MappedChunks {
+	//map a file and find its chunks:
+	// note: throws if the file can't be opened or isn't a sequence of whole chunks
+	MappedChunks(std::string const &filename);
+	~MappedChunks();
+
+	MappedChunks(MappedChunks const &) = delete;
+	MappedChunks &operator=(MappedChunks const &) = delete;
+
+	//a chunk's data, as an array of T:
+	// (elements are copied out on access, since chunk data isn't necessarily aligned for T)
+	template< typename T >
+	struct Span {
+		static_assert(std::is_trivially_copyable< T >::value, "Chunk elements are copied bytewise.");
+		uint8_t const *bytes = nullptr;
+		size_t count = 0;
+
+		size_t size() const { return count; }
+		bool empty() const { return count == 0; }
+		void const *data() const { return bytes; }
+		size_t size_bytes() const { return count * sizeof(T); }
+
+		T operator[](size_t i) const {
+			if (i >= count) {
+				throw std::out_of_range("Chunk element " + std::to_string(i) + " of " + std::to_string(count) + " is out of range.");
+			}
+			T t;
+			std::memcpy(&t, bytes + i * sizeof(T), sizeof(T));
+			return t;
+		}
+
+		//(so spans work in range-based for loops)
+		struct iterator {
+			Span const *span;
+			size_t i;
+			T operator*() const { return (*span)[i]; }
+			iterator &operator++() { ++i; return *this; }
+			bool operator!=(iterator const &other) const { return i != other.i; }
+		};
+		iterator begin() const { return iterator{ this, 0 }; }
+		iterator end() const { return iterator{ this, count }; }
+	};
+
+	//is there a chunk with this magic number?
+	bool has(std::string const &magic) const;
+
+	//the chunk with this magic number, as an array of T:
+	// note: throws if there is no such chunk or its size isn't a multiple of sizeof(T)
+	template< typename T >
+	Span< T > get(std::string const &magic) const;
+
+	std::string filename;
+
+	//-- internals ---
+	uint8_t const *base = nullptr; //the mapping (nullptr for an empty file)
+	size_t size = 0;
+
+	struct Chunk {
+		char magic[4];
+		size_t offset; //where the chunk's data starts in the file
+		uint32_t size; //bytes of data
+	};
+	std::vector< Chunk > chunks; //(in file order)
+
+	//the chunk with this magic number (or nullptr):
+	Chunk const *find(std::string const &magic) const;
+
+	//(un-map and close the file)
+	void unmap();
+
+	#ifdef _WIN32
+	void *file_handle = nullptr;
+	void *mapping_handle = nullptr;
+	#else
+	int fd = -1;
+	#endif
+};
+
+template< typename T >
+MappedChunks::Span< T > MappedChunks::get(std::string const &magic) const {
+	Chunk const *chunk = find(magic);
+	if (!chunk) {
+		throw std::runtime_error("File '" + filename + "' has no '" + magic + "' chunk.");
+	}
+	if (chunk->size % sizeof(T) != 0) {
+		throw std::runtime_error("Size of '" + magic + "' chunk in '" + filename + "' not divisible by element size.");
+	}
+	Span< T > span;
+	span.bytes = base + chunk->offset;
+	span.count = chunk->size / sizeof(T);
+	return span;
+}
@@ -1,20 +1,21 @@
 #include "Mesh.hpp"
-#include "read_write_chunk.hpp"
+#include "MappedChunks.hpp"
 
 #include <glm/glm.hpp>
 
 #include <stdexcept>
-#include <fstream>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <set>
 #include <cstddef>
+#include <cstring>
 
 MeshBuffer::MeshBuffer(std::string const &filename) {
 	glGenBuffers(1, &buffer);
 
-	std::ifstream file(filename, std::ios::binary);
+	//(the file is mapped rather than read, so vertex data goes straight from the file to glBufferData)
+	MappedChunks file(filename);
 
 	GLuint total = 0;
 
@@ -25,15 +26,47 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		glm::vec2 TexCoord;
 	};
 	static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
-	std::vector< Vertex > data;
+	MappedChunks::Span< Vertex > data;
 
-	//read + upload data chunk:
-	if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".pnct") {
-		read_chunk(file, "pnct", &data);
+	//quantized files (see MeshFile::QuantizedVertex) store the same attributes more compactly:
+	struct QuantizedVertex {
+		glm::u16vec4 Position; //(fraction of the mesh's QuantizedBox)
+		uint32_t Normal; //(10:10:10:2 signed normalized)
+		glm::u8vec4 Color;
+		uint32_t TexCoord; //(2 half floats)
+	};
+	static_assert(sizeof(QuantizedVertex) == 2*4+4+4*1+4, "QuantizedVertex is packed.");
+	struct QuantizedBox {
+		glm::vec3 min;
+		glm::vec3 size;
+	};
+	static_assert(sizeof(QuantizedBox) == 2*3*4, "QuantizedBox is packed.");
+	MappedChunks::Span< QuantizedBox > boxes; //(one per mesh, if quantized)
+
+	//find + upload data chunk:
+	if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".pnct" && file.has("qnct")) {
+		MappedChunks::Span< QuantizedVertex > quantized = file.get< QuantizedVertex >("qnct");
+		boxes = file.get< QuantizedBox >("qpos");
+
+		//upload data:
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferData(GL_ARRAY_BUFFER, quantized.size_bytes(), quantized.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		total = GLuint(quantized.size()); //store total for later checks on index
+
+		//store attrib locations:
+		// (positions come out of the vertex fetch as 0-1 fractions of the mesh's box; Scene::draw scales them back -- see Mesh::position_scale)
+		Position = Attrib(3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, Position));
+		Normal = Attrib(4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, Normal));
+		Color = Attrib(4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, Color));
+		TexCoord = Attrib(2, GL_HALF_FLOAT, GL_FALSE, sizeof(QuantizedVertex), offsetof(QuantizedVertex, TexCoord));
+	} else if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".pnct") {
+		data = file.get< Vertex >("pnct");
 
 		//upload data:
 		glBindBuffer(GL_ARRAY_BUFFER, buffer);
-		glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(Vertex), data.data(), GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, data.size_bytes(), data.data(), GL_STATIC_DRAW);
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 		total = GLuint(data.size()); //store total for later checks on index
@@ -47,34 +80,100 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		throw std::runtime_error("Unknown file type '" + filename + "'");
 	}
 
-	std::vector< char > strings;
-	read_chunk(file, "str0", &strings);
+	//find + upload index chunk (indexed files only):
+	GLuint total_indices = 0;
+	MappedChunks::Span< uint8_t > indices;
+	if (file.has("idx1")) {
+		if (file.has("ix16")) {
+			indices = file.get< uint8_t >("ix16");
+			index_type = GL_UNSIGNED_SHORT;
+			total_indices = GLuint(indices.size() / 2);
+		} else {
+			indices = file.get< uint8_t >("ix32");
+			index_type = GL_UNSIGNED_INT;
+			total_indices = GLuint(indices.size() / 4);
+		}
+
+		//(uploaded through GL_ARRAY_BUFFER because the GL_ELEMENT_ARRAY_BUFFER binding belongs to whatever vao is bound)
+		glGenBuffers(1, &index_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, index_buffer);
+		glBufferData(GL_ARRAY_BUFFER, indices.size_bytes(), indices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	MappedChunks::Span< char > strings = file.get< char >("str0");
 
 	{ //read index chunk, add to meshes:
+		// (the 'idx1' chunk of indexed files has index ranges after the same fields as 'idx0')
 		struct IndexEntry {
 			uint32_t name_begin, name_end;
 			uint32_t vertex_begin, vertex_end;
+			uint32_t index_begin, index_end;
 		};
-		static_assert(sizeof(IndexEntry) == 16, "Index entry should be packed");
+		static_assert(sizeof(IndexEntry) == 24, "Index entry should be packed");
+		size_t entry_size = (index_type != 0 ? sizeof(IndexEntry) : 4 * sizeof(uint32_t));
+
+		MappedChunks::Span< uint8_t > index = file.get< uint8_t >(index_type != 0 ? "idx1" : "idx0");
+		if (index.size() % entry_size != 0) {
+			throw std::runtime_error("Size of index chunk in '" + filename + "' not divisible by entry size.");
+		}
 
-		std::vector< IndexEntry > index;
-		read_chunk(file, "idx0", &index);
+		if (boxes.size() != 0 && boxes.size() != index.size() / entry_size) {
+			throw std::runtime_error("File '" + filename + "' has a different number of quantized boxes than meshes.");
+		}
+
+		for (size_t at = 0; at < index.size(); at += entry_size) {
+			IndexEntry entry;
+			entry.index_begin = entry.index_end = 0;
+			std::memcpy(&entry, index.bytes + at, entry_size);
 
-		for (auto const &entry : index) {
 			if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
 				throw std::runtime_error("index entry has out-of-range name begin/end");
 			}
 			if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= total)) {
 				throw std::runtime_error("index entry has out-of-range vertex start/count");
 			}
-			std::string name(&strings[0] + entry.name_begin, &strings[0] + entry.name_end);
+			if (!(entry.index_begin <= entry.index_end && entry.index_end <= total_indices)) {
+				throw std::runtime_error("index entry has out-of-range index start/count");
+			}
+			std::string name(reinterpret_cast< char const * >(strings.data()) + entry.name_begin, entry.name_end - entry.name_begin);
 			Mesh mesh;
 			mesh.type = GL_TRIANGLES;
 			mesh.start = entry.vertex_begin;
 			mesh.count = entry.vertex_end - entry.vertex_begin;
-			for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
-				mesh.min = glm::min(mesh.min, data[v].Position);
-				mesh.max = glm::max(mesh.max, data[v].Position);
+			if (index_type != 0) {
+				mesh.index_type = index_type;
+				mesh.index_start = entry.index_begin;
+				mesh.index_count = entry.index_end - entry.index_begin;
+				//(indices count from the mesh's first vertex, and drawing past its last one is undefined, so check them all)
+				for (uint32_t i = entry.index_begin; i < entry.index_end; ++i) {
+					uint32_t value = 0;
+					if (index_type == GL_UNSIGNED_SHORT) {
+						uint16_t value_16;
+						std::memcpy(&value_16, indices.bytes + 2 * i, 2);
+						value = value_16;
+					} else {
+						std::memcpy(&value, indices.bytes + 4 * i, 4);
+					}
+					if (value >= mesh.count) {
+						throw std::runtime_error("mesh '" + name + "' in '" + filename + "' has an index past its last vertex");
+					}
+				}
+			}
+			if (boxes.size() != 0) {
+				QuantizedBox box = boxes[at / entry_size];
+				mesh.position_scale = box.size;
+				mesh.position_offset = box.min;
+				if (entry.vertex_begin < entry.vertex_end) {
+					mesh.min = box.min;
+					mesh.max = box.min + box.size;
+				}
+			} else {
+				for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
+					glm::vec3 position = data[v].Position;
+					mesh.min = glm::min(mesh.min, position);
+					mesh.max = glm::max(mesh.max, position);
+				}
 			}
 			bool inserted = meshes.insert(std::make_pair(name, mesh)).second;
 			if (!inserted) {
@@ -83,10 +182,6 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		}
 	}
 
-	if (file.peek() != EOF) {
-		std::cerr << "WARNING: trailing data in mesh file '" << filename << "'" << std::endl;
-	}
-
 	/* //DEBUG:
 	std::cout << "File '" << filename << "' contained meshes";
 	for (auto const &m : meshes) {
@@ -128,6 +223,8 @@ GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
 	bind_attribute("Color", Color);
 	bind_attribute("TexCoord", TexCoord);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	//(the element array binding is part of the vao, so indexed draws with it use index_buffer)
+	if (index_buffer != 0) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
 	glBindVertexArray(0);
 
 	//Check that all active attributes were bound:
@@ -140,6 +237,8 @@ GLuint MeshBuffer::make_vao_for_program(GLuint program) const {
 		GLenum type = 0;
 		glGetActiveAttrib(program, i, 100, NULL, &size, &type, name);
 		name[99] = '\0';
+		//(per-instance attributes are supplied at draw time -- see Scene::Drawable::Pipeline::instanced())
+		if (std::string(name).compare(0, 8, "Instance") == 0) continue;
 		GLint location = glGetAttribLocation(program, name);
 		if (!bound.count(GLuint(location))) {
 			throw std::runtime_error("ERROR: active attribute '" + std::string(name) + "' in program is not bound.");
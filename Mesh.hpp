@@ -7,6 +7,11 @@
  *  a single OpenGL array buffer. Individual meshes can be looked up by name
  *  using the MeshBuffer::lookup() function.
  *
+ * Files may also be indexed (see MeshFile.hpp and weld-meshes.cpp), in which
+ *  case each mesh also has a range of indices into its vertices, and/or
+ *  quantized (see quantize-meshes.cpp), in which case the vertices take
+ *  about half the space.
+ *
  */
 
 #include "GL.hpp"
@@ -23,6 +28,17 @@ struct Mesh {
 	GLuint start = 0; //index of first vertex
 	GLuint count = 0; //count of vertices
 
+	//Meshes from indexed files are instead drawn from a range of MeshBuffer::index_buffer:
+	// (indices count from 'start', so pass it as the base vertex to glDrawElementsBaseVertex)
+	GLenum index_type = 0; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT (or 0 if the mesh isn't indexed)
+	GLuint index_start = 0; //index of first index
+	GLuint index_count = 0; //count of indices
+
+	//Meshes from quantized files store positions as fractions of their bounding box, so drawing them needs the real position, which is 'position_offset + position_scale * Position':
+	// (copy these to Scene::Drawable::Pipeline, which takes care of it)
+	glm::vec3 position_scale = glm::vec3(1.0f);
+	glm::vec3 position_offset = glm::vec3(0.0f);
+
 	//Bounding box.
 	//useful for debug visualization and (perhaps, eventually) collision detection:
 	glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
@@ -44,6 +60,9 @@ struct MeshBuffer {
 
 	//This is the OpenGL vertex buffer object containing the mesh data:
 	GLuint buffer = 0;
+	//...and, for indexed files, the buffer containing the indices (bound as the element array buffer of vaos from make_vao_for_program):
+	GLuint index_buffer = 0;
+	GLenum index_type = 0; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT (or 0 if not indexed)
 
 	//-- internals ---
 
@@ -0,0 +1,250 @@
+#include "MeshFile.hpp"
+#include "MappedChunks.hpp"
+#include "read_write_chunk.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+
+//mesh entries, as stored in the 'idx0' (triangle soup) and 'idx1' (indexed) chunks:
+struct IndexEntry0 {
+	uint32_t name_begin, name_end;
+	uint32_t vertex_begin, vertex_end;
+};
+static_assert(sizeof(IndexEntry0) == 16, "Index entry should be packed");
+
+struct IndexEntry1 {
+	uint32_t name_begin, name_end;
+	uint32_t vertex_begin, vertex_end;
+	uint32_t index_begin, index_end;
+};
+static_assert(sizeof(IndexEntry1) == 24, "Index entry should be packed");
+
+static MeshFile::QuantizedVertex quantize(MeshFile::Vertex const &v, MeshFile::QuantizedBox const &box) {
+	MeshFile::QuantizedVertex q;
+	for (uint32_t i = 0; i < 3; ++i) {
+		float f = (box.size[i] > 0.0f ? (v.Position[i] - box.min[i]) / box.size[i] : 0.0f);
+		q.Position[i] = uint16_t(std::round(glm::clamp(f, 0.0f, 1.0f) * 65535.0f));
+	}
+	q.Position.w = 0;
+	glm::vec3 n = v.Normal;
+	float length = glm::length(n);
+	if (length > 0.0f) n /= length;
+	q.Normal = 0;
+	for (uint32_t i = 0; i < 3; ++i) {
+		int32_t c = int32_t(std::round(glm::clamp(n[i], -1.0f, 1.0f) * 511.0f));
+		q.Normal |= (uint32_t(c) & 0x3ff) << (10 * i);
+	}
+	q.Color = v.Color;
+	q.TexCoord = glm::packHalf2x16(v.TexCoord);
+	return q;
+}
+
+static MeshFile::Vertex dequantize(MeshFile::QuantizedVertex const &q, MeshFile::QuantizedBox const &box) {
+	MeshFile::Vertex v;
+	for (uint32_t i = 0; i < 3; ++i) {
+		v.Position[i] = box.min[i] + box.size[i] * (float(q.Position[i]) / 65535.0f);
+		int32_t c = int32_t(q.Normal << (22 - 10 * i)) >> 22; //(sign-extend the 10-bit field)
+		v.Normal[i] = std::max(float(c) / 511.0f, -1.0f);
+	}
+	v.Color = q.Color;
+	v.TexCoord = glm::unpackHalf2x16(q.TexCoord);
+	return v;
+}
+
+MeshFile::MeshFile(std::string const &filename) {
+	MappedChunks file(filename);
+
+	//(quantized vertices are converted once the meshes -- and so which box each vertex is in -- are known)
+	MappedChunks::Span< QuantizedVertex > quantized_data;
+	if (file.has("qnct")) {
+		quantized = true;
+		quantized_data = file.get< QuantizedVertex >("qnct");
+		vertices.resize(quantized_data.size());
+	} else {
+		MappedChunks::Span< Vertex > data = file.get< Vertex >("pnct");
+		vertices.resize(data.size());
+		if (!vertices.empty()) std::memcpy(vertices.data(), data.data(), data.size_bytes());
+	}
+
+	MappedChunks::Span< char > strings = file.get< char >("str0");
+	auto name_of = [&](uint32_t begin, uint32_t end) {
+		if (!(begin <= end && end <= strings.size())) {
+			throw std::runtime_error("index entry has out-of-range name begin/end");
+		}
+		return std::string(reinterpret_cast< char const * >(strings.data()) + begin, end - begin);
+	};
+	auto check_vertices = [&](uint32_t begin, uint32_t end) {
+		if (!(begin <= end && end <= vertices.size())) {
+			throw std::runtime_error("index entry has out-of-range vertex start/count");
+		}
+	};
+
+	if (file.has("idx1")) {
+		indexed = true;
+		if (file.has("ix16")) {
+			for (uint16_t i : file.get< uint16_t >("ix16")) indices.emplace_back(i);
+		} else {
+			for (uint32_t i : file.get< uint32_t >("ix32")) indices.emplace_back(i);
+		}
+		for (auto const &entry : file.get< IndexEntry1 >("idx1")) {
+			check_vertices(entry.vertex_begin, entry.vertex_end);
+			if (!(entry.index_begin <= entry.index_end && entry.index_end <= indices.size())) {
+				throw std::runtime_error("index entry has out-of-range index start/count");
+			}
+			for (uint32_t i = entry.index_begin; i < entry.index_end; ++i) {
+				if (indices[i] >= entry.vertex_end - entry.vertex_begin) {
+					throw std::runtime_error("index " + std::to_string(i) + " in '" + filename + "' is past the end of its mesh's vertices");
+				}
+			}
+			Mesh mesh;
+			mesh.name = name_of(entry.name_begin, entry.name_end);
+			mesh.vertex_begin = entry.vertex_begin;
+			mesh.vertex_end = entry.vertex_end;
+			mesh.index_begin = entry.index_begin;
+			mesh.index_end = entry.index_end;
+			meshes.emplace_back(mesh);
+		}
+	} else {
+		for (auto const &entry : file.get< IndexEntry0 >("idx0")) {
+			check_vertices(entry.vertex_begin, entry.vertex_end);
+			Mesh mesh;
+			mesh.name = name_of(entry.name_begin, entry.name_end);
+			mesh.vertex_begin = entry.vertex_begin;
+			mesh.vertex_end = entry.vertex_end;
+			meshes.emplace_back(mesh);
+		}
+	}
+
+	if (quantized) {
+		MappedChunks::Span< QuantizedBox > boxes = file.get< QuantizedBox >("qpos");
+		if (boxes.size() != meshes.size()) {
+			throw std::runtime_error("File '" + filename + "' has " + std::to_string(boxes.size()) + " quantized boxes for " + std::to_string(meshes.size()) + " meshes.");
+		}
+		for (uint32_t m = 0; m < meshes.size(); ++m) {
+			QuantizedBox box = boxes[m];
+			for (uint32_t v = meshes[m].vertex_begin; v < meshes[m].vertex_end; ++v) {
+				vertices[v] = dequantize(quantized_data[v], box);
+			}
+		}
+	}
+}
+
+void MeshFile::save(std::string const &filename) const {
+	std::vector< char > strings;
+	for (auto const &mesh : meshes) {
+		strings.insert(strings.end(), mesh.name.begin(), mesh.name.end());
+	}
+
+	std::ofstream out(filename, std::ios::binary);
+	if (quantized) {
+		//each vertex is quantized within the box of the mesh it is in:
+		std::vector< QuantizedVertex > quantized_vertices(vertices.size());
+		std::vector< bool > done(vertices.size(), false);
+		std::vector< QuantizedBox > boxes;
+		for (auto const &mesh : meshes) {
+			glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+			glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+			for (uint32_t v = mesh.vertex_begin; v < mesh.vertex_end; ++v) {
+				min = glm::min(min, vertices[v].Position);
+				max = glm::max(max, vertices[v].Position);
+			}
+			QuantizedBox box;
+			box.min = (mesh.vertex_begin < mesh.vertex_end ? min : glm::vec3(0.0f));
+			box.size = (mesh.vertex_begin < mesh.vertex_end ? max - min : glm::vec3(0.0f));
+			boxes.emplace_back(box);
+			for (uint32_t v = mesh.vertex_begin; v < mesh.vertex_end; ++v) {
+				if (done[v]) {
+					throw std::runtime_error("Can't quantize '" + filename + "': vertex " + std::to_string(v) + " is in more than one mesh.");
+				}
+				done[v] = true;
+				quantized_vertices[v] = quantize(vertices[v], box);
+			}
+		}
+		write_chunk("qnct", quantized_vertices, &out);
+		write_chunk("qpos", boxes, &out);
+	} else {
+		write_chunk("pnct", vertices, &out);
+	}
+
+	uint32_t name_begin = 0;
+	if (indexed) {
+		if (index_size() == 2) {
+			std::vector< uint16_t > indices_16(indices.begin(), indices.end());
+			write_chunk("ix16", indices_16, &out);
+		} else {
+			write_chunk("ix32", indices, &out);
+		}
+		write_chunk("str0", strings, &out);
+		std::vector< IndexEntry1 > entries;
+		for (auto const &mesh : meshes) {
+			uint32_t name_end = name_begin + uint32_t(mesh.name.size());
+			entries.emplace_back(IndexEntry1{ name_begin, name_end, mesh.vertex_begin, mesh.vertex_end, mesh.index_begin, mesh.index_end });
+			name_begin = name_end;
+		}
+		write_chunk("idx1", entries, &out);
+	} else {
+		write_chunk("str0", strings, &out);
+		std::vector< IndexEntry0 > entries;
+		for (auto const &mesh : meshes) {
+			uint32_t name_end = name_begin + uint32_t(mesh.name.size());
+			entries.emplace_back(IndexEntry0{ name_begin, name_end, mesh.vertex_begin, mesh.vertex_end });
+			name_begin = name_end;
+		}
+		write_chunk("idx0", entries, &out);
+	}
+
+	if (!out) {
+		throw std::runtime_error("Failed to write '" + filename + "'.");
+	}
+}
+
+uint32_t MeshFile::index_size() const {
+	for (uint32_t i : indices) {
+		if (i > 0xffff) return 4;
+	}
+	return 2;
+}
+
+std::vector< uint32_t > MeshFile::corners(Mesh const &mesh) const {
+	if (indexed) {
+		return std::vector< uint32_t >(indices.begin() + mesh.index_begin, indices.begin() + mesh.index_end);
+	} else {
+		std::vector< uint32_t > ret(mesh.vertex_end - mesh.vertex_begin);
+		for (uint32_t i = 0; i < ret.size(); ++i) {
+			ret[i] = i;
+		}
+		return ret;
+	}
+}
+
+void MeshFile::weld() {
+	//vertices are only merged if they are bit-for-bit identical, so welding never changes what gets drawn:
+	std::vector< Vertex > new_vertices;
+	std::vector< uint32_t > new_indices;
+	for (auto &mesh : meshes) {
+		std::vector< uint32_t > old_corners = corners(mesh);
+		uint32_t vertex_begin = uint32_t(new_vertices.size());
+		uint32_t index_begin = uint32_t(new_indices.size());
+
+		std::unordered_map< std::string, uint32_t > welded; //vertex bytes -> index (from vertex_begin)
+		for (uint32_t c : old_corners) {
+			Vertex const &v = vertices[mesh.vertex_begin + c];
+			std::string key(reinterpret_cast< char const * >(&v), sizeof(Vertex));
+			auto ret = welded.emplace(key, uint32_t(new_vertices.size()) - vertex_begin);
+			if (ret.second) new_vertices.emplace_back(v);
+			new_indices.emplace_back(ret.first->second);
+		}
+
+		mesh.vertex_begin = vertex_begin;
+		mesh.vertex_end = uint32_t(new_vertices.size());
+		mesh.index_begin = index_begin;
+		mesh.index_end = uint32_t(new_indices.size());
+	}
+	vertices = std::move(new_vertices);
+	indices = std::move(new_indices);
+	indexed = true;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+/*
+ * MeshFile holds the whole contents of a mesh file (the '.pnct' format
+ *  MeshBuffer loads) in plain vectors, for offline tools that read a mesh
+ *  file, change it, and write it back out:
+
+	MeshFile file("../dist/game2-city.pnct");
+	file.weld(); //...or whatever else...
+	file.save("../dist/game2-city.pnct");
+
+ * Mesh files come in two variants:
+ *  - triangle soup: every three vertices in a mesh's range make a triangle.
+ *    chunks: 'pnct' (vertices), 'str0' (names), 'idx0' (meshes)
+ *  - indexed: every three indices in a mesh's index range make a triangle;
+ *    indices count from the first vertex in the mesh's vertex range.
+ *    chunks: 'pnct' (vertices), 'ix16' or 'ix32' (indices), 'str0' (names), 'idx1' (meshes)
+ *
+ * Either variant may also store its vertices quantized, in a 'qnct' chunk
+ *  instead of 'pnct' (see QuantizedVertex), followed by a 'qpos' chunk with
+ *  each mesh's position box (see QuantizedBox).
+ */
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct MeshFile {
+	//load from a file (any variant; quantized vertices are converted back to floats):
+	// note: will throw if the file fails to read or is inconsistent
+	MeshFile(std::string const &filename);
+
+	//write to a file (the indexed variant if there are indices, using 16-bit indices if they all fit; quantized if 'quantized' is set):
+	// note: quantized files need every vertex to be in exactly one mesh's range, and will throw otherwise
+	void save(std::string const &filename) const;
+
+	//turn a triangle soup into an indexed mesh that shares identical vertices within each mesh:
+	// (already-indexed files get re-welded, which drops any duplicate or unused vertices)
+	void weld();
+
+	//same layout as MeshBuffer loads:
+	struct Vertex {
+		glm::vec3 Position;
+		glm::vec3 Normal;
+		glm::u8vec4 Color;
+		glm::vec2 TexCoord;
+	};
+	static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
+
+	//quantized vertices, in a layout that MeshBuffer hands straight to glVertexAttribPointer:
+	struct QuantizedVertex {
+		glm::u16vec4 Position; //xyz: normalized (0 - 65535) position within the mesh's QuantizedBox; w: unused (0)
+		uint32_t Normal; //signed normalized x, y, z (10 bits each, from the low bits up), as GL_INT_2_10_10_10_REV
+		glm::u8vec4 Color;
+		uint32_t TexCoord; //two half floats (u in the low bits), as glm::packHalf2x16
+	};
+	static_assert(sizeof(QuantizedVertex) == 2*4+4+4*1+4, "QuantizedVertex is packed.");
+
+	//each mesh's position box (in the same order as the 'idx0'/'idx1' entries); Position = min + size * (quantized Position / 65535):
+	struct QuantizedBox {
+		glm::vec3 min;
+		glm::vec3 size;
+	};
+	static_assert(sizeof(QuantizedBox) == 2*3*4, "QuantizedBox is packed.");
+
+	struct Mesh {
+		std::string name;
+		uint32_t vertex_begin = 0, vertex_end = 0;
+		uint32_t index_begin = 0, index_end = 0; //(only meaningful if indexed)
+	};
+
+	std::vector< Vertex > vertices;
+	std::vector< uint32_t > indices; //relative to each mesh's vertex_begin
+	std::vector< Mesh > meshes; //(in file order)
+	bool indexed = false;
+	bool quantized = false;
+
+	//bytes per index that save() will use (2 if every index fits in 16 bits, otherwise 4):
+	uint32_t index_size() const;
+
+	//the triangle corners of a mesh, as vertex numbers (from vertex_begin, whether or not the file is indexed):
+	std::vector< uint32_t > corners(Mesh const &mesh) const;
+};
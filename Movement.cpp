@@ -0,0 +1,58 @@
+#include "Movement.hpp"
+
+#include "Scene.hpp"
+
+#include <string>
+
+//how close players can get to the sides of a building:
+constexpr float PlayerRadius = 0.125f;
+
+Obstacles find_obstacles(Scene const &scene) {
+	Obstacles obstacles;
+	std::vector< BVH::Box > boxes;
+	for (auto const &transform : scene.transforms) {
+		if (transform.name.find("Roof") == std::string::npos) continue;
+		//(a roof covers its position +/- its scale, and its building is right under it)
+		glm::vec2 center = glm::vec2(transform.position());
+		glm::vec2 extent = glm::vec2(transform.scale()) + glm::vec2(PlayerRadius);
+		boxes.emplace_back(BVH::Box{ glm::vec3(center - extent, 0.0f), glm::vec3(center + extent, 0.0f) });
+	}
+	obstacles.bvh.build(boxes);
+	return obstacles;
+}
+
+//(this was PlayMode's movement code, from my game3 code -- now shared so the server can run it too)
+glm::vec3 move_player(glm::vec3 const &position, MoveInput const &input, float speed, Obstacles const &obstacles) {
+	if (speed == 0.0f) return position;
+
+	//combine buttons into a move:
+	glm::vec2 move = glm::vec2(0.0f);
+	if ((input.buttons & MoveLeft) && !(input.buttons & MoveRight)) move.x = -1.0f;
+	if (!(input.buttons & MoveLeft) && (input.buttons & MoveRight)) move.x = 1.0f;
+	if ((input.buttons & MoveDown) && !(input.buttons & MoveUp)) move.y = -1.0f;
+	if (!(input.buttons & MoveDown) && (input.buttons & MoveUp)) move.y = 1.0f;
+
+	//make it so that moving diagonally doesn't go faster:
+	if (move != glm::vec2(0.0f)) move = glm::normalize(move) * speed * MoveStep;
+
+	//move relative to the camera:
+	glm::quat rotation = unpack_rotation(input.rotation);
+	glm::vec3 right = rotation * glm::vec3(1.0f, 0.0f, 0.0f);
+	glm::vec3 forward = rotation * glm::vec3(0.0f, 0.0f, -1.0f);
+	glm::vec3 new_pos = position + move.x * right + move.y * forward;
+
+	//don't enter buildings:
+	// (the BVH's boxes are exactly the obstacles, so any box it finds around the new position is one the player would be inside)
+	bool blocked = false;
+	glm::vec3 at = glm::vec3(glm::vec2(new_pos), 0.0f);
+	obstacles.bvh.query_box(BVH::Box{ at, at }, [&](uint32_t){
+		blocked = true;
+	});
+	if (blocked) new_pos = position;
+
+	//stay within the city:
+	new_pos.x = glm::clamp(new_pos.x, CityMin.x, CityMax.x);
+	new_pos.y = glm::clamp(new_pos.y, CityMin.y, CityMax.y);
+	new_pos.z = PlayerHeight;
+	return new_pos;
+}
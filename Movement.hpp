@@ -0,0 +1,85 @@
+#pragma once
+
+/*
+ * Player movement, shared by PlayMode (which predicts its own player) and
+ *  server.cpp (which decides where every player really is).
+ *
+ * Clients sample their controls every MoveStep seconds into a numbered
+ *  MoveInput, move their own player right away, and send the input to the
+ *  server. The server runs the same move_player() on the inputs it gets
+ *  and tells the client which input it got to and where that left the
+ *  player; the client then starts from there and re-applies the inputs the
+ *  server hasn't seen yet.
+ *
+ * On the wire (all big-endian, see quantize.hpp):
+ *  client -> server: 'i' | sequence number of the first input (4) | count (1) | count x (buttons (1) | rotation (4))
+ *   (each message repeats the newest few inputs, so a lost message doesn't lose any)
+ *  server -> client: 'r' | sequence number of the last input applied (4) | position (3 x 2)
+ */
+
+#include "quantize.hpp"
+#include "BVH.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+struct Scene;
+
+//the city (players stay inside this rectangle, at PlayerHeight):
+const glm::vec2 CityMin = glm::vec2(-7.0f, -15.0f);
+const glm::vec2 CityMax = glm::vec2(19.0f, 21.0f);
+constexpr float PlayerHeight = 0.6f;
+
+//each input moves a player for this long:
+constexpr float MoveStep = 1.0f / 60.0f;
+
+//movement speed (units/second); "it" moves faster, but can't move at all for ItFreeze seconds after being tagged:
+constexpr float PlayerSpeed = 3.0f;
+constexpr float ItSpeedup = 1.5f;
+constexpr float ItFreeze = 3.0f;
+
+//'buttons' bits:
+enum : uint8_t {
+	MoveLeft = 0x01,
+	MoveRight = 0x02,
+	MoveDown = 0x04,
+	MoveUp = 0x08,
+};
+
+struct MoveInput {
+	uint8_t buttons = 0;
+	uint32_t rotation = 0; //camera rotation, from pack_rotation() (so both sides move along exactly the same directions)
+};
+
+//most inputs in one 'i' message, and the size of such a message:
+constexpr uint32_t MaxInputsPerMessage = 8;
+constexpr size_t input_message_size(uint32_t count) {
+	return 1 + 4 + 1 + count * (1 + 4);
+}
+
+//size of an 'r' message:
+constexpr size_t ReconcileBytes = 1 + 4 + 3 * 2;
+
+//write an 'i' message holding inputs first_seq, first_seq+1, ... to 'to' (which needs input_message_size(count) bytes):
+inline void encode_inputs(uint32_t first_seq, MoveInput const *inputs, uint32_t count, uint8_t *to) {
+	to[0] = 'i';
+	put_uint32(first_seq, to + 1);
+	to[5] = uint8_t(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		to[6 + i * 5] = inputs[i].buttons;
+		put_uint32(inputs[i].rotation, to + 6 + i * 5 + 1);
+	}
+}
+
+//the buildings, as a BVH over the boxes players can't walk into, so a move only checks the ones it ends up near:
+struct Obstacles {
+	BVH bvh; //(each box is flat, at z = 0, since only the xy plane matters)
+};
+
+//the buildings (the scene's "Roof" transforms), padded by the player's radius:
+Obstacles find_obstacles(Scene const &scene);
+
+//where one input (MoveStep seconds of movement at 'speed') takes a player:
+// (a step that would end inside an obstacle doesn't happen)
+glm::vec3 move_player(glm::vec3 const &position, MoveInput const &input, float speed, Obstacles const &obstacles);
@@ -4,6 +4,7 @@
 #include "gl_errors.hpp"
 #include "data_path.hpp"
 #include "hex_dump.hpp"
+#include "quantize.hpp"
 
 #include "LitColorTextureProgram.hpp"
 #include "Mesh.hpp"
@@ -13,11 +14,21 @@
 
 #include <random>
 
+//inputs are sent every InputSendSteps steps (each message repeating the newest MaxInputsPerMessage):
+constexpr uint32_t InputSendSteps = 2;
+//inputs the server hasn't acknowledged are given up on after this many:
+constexpr size_t MaxPendingInputs = 120;
+
+//how far (in seconds) remote players are shown behind the newest snapshot;
+// should cover a few ticks, so there is usually a snapshot on either side even when one is late or lost:
+constexpr float InterpolationDelay = 0.1f;
+
 //from the game2 base code:
-GLuint game2city_meshes_for_lit_color_texture_program = 0;
+// (now drawn with the instanced program, since the city is mostly copies of a few building and roof meshes)
+GLuint game2city_meshes_for_lit_color_texture_instanced_program = 0;
 Load< MeshBuffer > game2city_meshes(LoadTagDefault, []() -> MeshBuffer const * {
 	MeshBuffer const *ret = new MeshBuffer(data_path("game2-city.pnct"));
-	game2city_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
+	game2city_meshes_for_lit_color_texture_instanced_program = ret->make_vao_for_program(lit_color_texture_instanced_program->program);
 	return ret;
 });
 
@@ -29,23 +40,36 @@ Load< Scene > game2city_scene(LoadTagDefault, []() -> Scene const * {
 		scene.drawables.emplace_back(transform);
 		Scene::Drawable &drawable = scene.drawables.back();
 
-		drawable.pipeline = lit_color_texture_program_pipeline;
+		drawable.pipeline = lit_color_texture_instanced_program_pipeline;
 
-		drawable.pipeline.vao = game2city_meshes_for_lit_color_texture_program;
+		drawable.pipeline.vao = game2city_meshes_for_lit_color_texture_instanced_program;
 		drawable.pipeline.type = mesh.type;
 		drawable.pipeline.start = mesh.start;
 		drawable.pipeline.count = mesh.count;
+		drawable.pipeline.index_type = mesh.index_type;
+		drawable.pipeline.index_start = mesh.index_start;
+		drawable.pipeline.index_count = mesh.index_count;
+		drawable.pipeline.position_scale = mesh.position_scale;
+		drawable.pipeline.position_offset = mesh.position_offset;
+		drawable.pipeline.min = mesh.min;
+		drawable.pipeline.max = mesh.max;
 	});
 });
 //end of code from game2 base code
 
-PlayMode::PlayMode(Client &client_) : client(client_), scene(*game2city_scene) {
-	//get pointers to the roofs for convience
-	for (auto &transform : scene.transforms) {
-		//referenced for checking is a string includes a substring: https://stackoverflow.com/questions/2340281/check-if-a-string-contains-a-string-in-c
-		if (transform.name.find("Roof") != std::string::npos)
-			roof_transforms.emplace_back(&transform);
-	}
+PlayMode::PlayMode(Client &client_, UDPClient &udp_client_) : client(client_), udp_client(udp_client_), scene(*game2city_scene) {
+	//the buildings, for keeping players out of them:
+	obstacles = find_obstacles(scene);
+
+	//light (the city scene has no Lights of its own, so it gets a hemisphere light from above):
+	scene.fallback_light.TYPE = 1;
+	scene.fallback_light.DIRECTION = glm::vec4(0.0f, 0.0f,-1.0f, 0.0f);
+	scene.fallback_light.ENERGY = glm::vec4(1.0f, 1.0f, 0.95f, 0.0f);
+
+	//keep the transforms in flat arrays, so world matrices are updated in one pass per frame (see draw()):
+	scene.build_flat();
+	//...and the drawables in a BVH, so drawing only looks at the ones that might be in view:
+	scene.build_bvh();
 	
 	//get pointers to cameras for convenience:
 	if (scene.cameras.size() != 4) throw std::runtime_error("Expecting scene to have exactly four cameras, but it has " + std::to_string(scene.cameras.size()));
@@ -113,15 +137,15 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 				-evt.motion.yrel / float(window_size.y)
 			);
 			//this section below lets the camera move based on mouse motion, but never about the y-axis
-			camera->transform->rotation
+			camera->transform->rotation()
 				*= glm::angleAxis(-motion.x * camera->fovy, glm::vec3(0.0f, 1.0f, 0.0f))
 				*= glm::angleAxis(motion.y * camera->fovy, glm::vec3(1.0f, 0.0f, 0.0f));
-			glm::vec3 euler = quaternion_to_euler(camera->transform->rotation);
+			glm::vec3 euler = quaternion_to_euler(camera->transform->rotation());
 			euler.x = glm::min(euler.x, 150.0f);
 			euler.x = glm::max(euler.x, 30.0f);
 			euler.y = 0.0f;
-			camera->transform->rotation = euler_to_quaternion(euler);
-			camera->transform->rotation = glm::normalize(camera->transform->rotation);
+			camera->transform->rotation() = euler_to_quaternion(euler);
+			camera->transform->rotation() = glm::normalize(camera->transform->rotation());
 			return true;
 		}
 	}
@@ -141,108 +165,48 @@ void PlayMode::update(float elapsed) {
 	if (camera != nullptr) {
 		time_since_connection += elapsed;
 
-		if (time_since_connection >= 0.2f) {
-			//queue camera position for sending to server (a ten byte message of type 'b'):
-			client.connections.back().send('b');
-
-			//get the sign for each axis of the camera position:
-			uint8_t x_pos_sign = 0;
-			if (camera->transform->position.x < 0.0f) x_pos_sign = 1;
-			uint8_t y_pos_sign = 0;
-			if (camera->transform->position.y < 0.0f) y_pos_sign = 1;
-			uint8_t z_pos_sign = 0;
-			if (camera->transform->position.z < 0.0f) z_pos_sign = 1;
-
-			//get the digits to the left of the deimcal point:
-			uint8_t x_pos = absolute_float_to_uint8_t(camera->transform->position.x);
-			uint8_t y_pos = absolute_float_to_uint8_t(camera->transform->position.y);
-			uint8_t z_pos = absolute_float_to_uint8_t(camera->transform->position.z);
-
-			//get the first two digits to the right of the decimal point:
-			uint8_t x_pos_decimal = absolute_float_to_uint8_t((std::abs(camera->transform->position.x) - x_pos) * 100.0f);
-			uint8_t y_pos_decimal = absolute_float_to_uint8_t((std::abs(camera->transform->position.y) - y_pos) * 100.0f);
-			uint8_t z_pos_decimal = absolute_float_to_uint8_t((std::abs(camera->transform->position.z) - z_pos) * 100.0f);
-
-			//queue the current camera position:
-			client.connections.back().send(x_pos_sign);
-			client.connections.back().send(x_pos);
-			client.connections.back().send(x_pos_decimal);
-			client.connections.back().send(y_pos_sign);
-			client.connections.back().send(y_pos);
-			client.connections.back().send(y_pos_decimal);
-			client.connections.back().send(z_pos_sign);
-			client.connections.back().send(z_pos);
-			client.connections.back().send(z_pos_decimal);
-
-			//TODO: queue the current camera rotation in euler angles
+		//how fast this player can move (not at all for a bit after becoming it):
+		float speed = 0.0f;
+		if (time_it >= ItFreeze) speed = (time_it == 5000.0f ? PlayerSpeed : PlayerSpeed * ItSpeedup);
+
+		//turn controls into one input per MoveStep (after a long hitch, only the last quarter second counts):
+		input_time = std::min(input_time + elapsed, 0.25f);
+		while (input_time >= MoveStep) {
+			input_time -= MoveStep;
+			PendingInput pending;
+			pending.seq = next_input_seq;
+			next_input_seq += 1;
+			if (left.pressed) pending.input.buttons |= MoveLeft;
+			if (right.pressed) pending.input.buttons |= MoveRight;
+			if (down.pressed) pending.input.buttons |= MoveDown;
+			if (up.pressed) pending.input.buttons |= MoveUp;
+			pending.input.rotation = pack_rotation(camera->transform->rotation());
+			pending.speed = speed;
+
+			//predict: move right away, instead of waiting for the server to say where the player ended up:
+			camera->transform->position() = move_player(camera->transform->position(), pending.input, speed, obstacles);
+
+			pending_inputs.emplace_back(pending);
+			if (pending_inputs.size() > MaxPendingInputs) pending_inputs.pop_front();
+			steps_since_send += 1;
 		}
 
-		//move camera:
-		if (time_it >= 3.0f) {
-			//from my game3 code (edited from base code), edited for game6:
-			//how fast the player moves
-			constexpr float PlayerSpeed = 3.0f;
-
-			//combine inputs into a move:
-			glm::vec2 move = glm::vec2(0.0f);
-			if (left.pressed && !right.pressed) move.x = -1.0f;
-			if (!left.pressed && right.pressed) move.x = 1.0f;
-			if (down.pressed && !up.pressed) move.y = -1.0f;
-			if (!down.pressed && up.pressed) move.y = 1.0f;
-
-			//make it so that moving diagonally doesn't go faster:
-			if (move != glm::vec2(0.0f)) {
-				if (time_it == 5000.0f)
-					move = glm::normalize(move) * PlayerSpeed * elapsed;
-				else
-					move = glm::normalize(move) * PlayerSpeed * elapsed * 1.5f;
-			}
-
-			glm::mat4x3 frame = camera->transform->make_local_to_world();
-			glm::vec3 right = frame[0];
-			glm::vec3 forward = -frame[2];
-
-			glm::vec3 new_pos = camera->transform->position + move.x * right + move.y * forward;
-
-			//check if camera would enter a building
-			for (auto transform : roof_transforms) {
-				glm::vec3 roof_pos = transform->position;
-				glm::vec3 roof_scale = transform->scale;
-				if (new_pos.x >= roof_pos.x - roof_scale.x - 0.125f && new_pos.x <= roof_pos.x + roof_scale.x + 0.125f &&
-					new_pos.y >= roof_pos.y - roof_scale.y - 0.125f && new_pos.y <= roof_pos.y + roof_scale.y + 0.125f) {
-					new_pos = camera->transform->position;
-					break;
-				}
-			}
-
-			camera->transform->position = new_pos;
-			
-			//adjust camera to be within bounds
-			if (camera->transform->position.x > 19.0f) camera->transform->position.x = 19.0f;
-			else if (camera->transform->position.x < -7.0f) camera->transform->position.x = -7.0f;
-			if (camera->transform->position.y > 21.0f) camera->transform->position.y = 21.0f;
-			else if (camera->transform->position.y < -15.0f) camera->transform->position.y = -15.0f;
-			camera->transform->position.z = 0.6f;
-			//end of code from game3
-
-			//tag someone if close enough:
-			if (time_it != 5000.0f) {
-				for (int i = 0; i < cameras.size(); i++) {
-					Scene::Camera *vector_cam = &cameras[i];
-					if (camera != vector_cam) {
-						glm::vec3 vector_cam_pos = vector_cam->transform->position;
-						if (vector_cam_pos.z >= 0.6f) {
-							glm::vec3 cam_pos = camera->transform->position;
-							float dist = std::sqrt(std::pow(cam_pos.x - vector_cam_pos.x, 2) + std::pow(cam_pos.y - vector_cam_pos.y, 2));
-							if (dist <= 0.25f) {
-								client.connections.back().send('t');
-								client.connections.back().send((uint8_t)(i));
-							}
-						}
-					}
-				}
+		if (steps_since_send >= InputSendSteps && !pending_inputs.empty()) {
+			//queue the newest inputs for sending to the server ('i' + first sequence number + count + inputs):
+			uint32_t count = uint32_t(std::min< size_t >(MaxInputsPerMessage, pending_inputs.size()));
+			auto first = pending_inputs.end() - count;
+			MoveInput inputs[MaxInputsPerMessage];
+			for (uint32_t i = 0; i < count; ++i) {
+				inputs[i] = (first + i)->input;
 			}
+			uint8_t message[input_message_size(MaxInputsPerMessage)];
+			encode_inputs(first->seq, inputs, count, message);
+			//(each input goes out in a few messages, so these can go unreliably)
+			send_to_server(UDPConnection::UnreliableChannel, message, input_message_size(count));
+			steps_since_send = 0;
 		}
+
+		//(tagging is decided by the server, which sends "You are it!" to whoever gets tagged)
 	}
 
 	//reset button press counters:
@@ -260,103 +224,214 @@ void PlayMode::update(float elapsed) {
 			throw std::runtime_error("Lost connection to server!");
 		} else { assert(event == Connection::OnRecv);
 			//std::cout << "[" << c->socket << "] recv'd data. Current buffer:\n" << hex_dump(c->recv_buffer); std::cout.flush();
-			//expecting message(s) like 'm' + 3-byte length + length bytes of text or as a list of floats representing transforms:
-			while (c->recv_buffer.size() >= 4) {
-				//std::cout << "[" << c->socket << "] recv'd data. Current buffer:\n" << hex_dump(c->recv_buffer); std::cout.flush();
-				char type = c->recv_buffer[0];
-				if (!(type == 'm' || type == 't')) {
-					throw std::runtime_error("Server sent unknown message type '" + std::to_string(type) + "'");
-				}
+			receive_messages(c->recv_buffer);
+		}
+	}, 0.0);
 
-				//the server sent a message to the client:
-				if (type == 'm')
-				{
-					uint32_t size = (
-						(uint32_t(c->recv_buffer[1]) << 16) | (uint32_t(c->recv_buffer[2]) << 8) | (uint32_t(c->recv_buffer[3]))
-						);
-					if (c->recv_buffer.size() < 4 + size) break; //if whole message isn't here, can't process
-					//whole message *is* here, so set current server message:
-					server_message = std::string(c->recv_buffer.begin() + 4, c->recv_buffer.begin() + 4 + size);
-
-					//and consume this part of the buffer:
-					c->recv_buffer.erase(c->recv_buffer.begin(), c->recv_buffer.begin() + 4 + size);
-
-					//for when the player is it:
-					if (time_it == 5000.0f && server_message == "You are it! Tag someone!")
-						time_it = 0.0f;
-
-					//for help with finding if a string contains a substring: https://stackoverflow.com/questions/2340281/check-if-a-string-contains-a-string-in-c
-					if (camera == nullptr && server_message.find("Client is player ") != std::string::npos) {
-						//for help with getting an int from a string: https://stackoverflow.com/questions/4442658/c-parse-int-from-string
-						std::cout << server_message << std::endl;
-						if (server_message == "Client is player 1")
-							client_num = 1;
-						else if (server_message == "Client is player 2")
-							client_num = 2;
-						else if (server_message == "Client is player 3")
-							client_num = 3;
-						else if (server_message == "Client is player 4")
-							client_num = 4;
-						if (client_num == -1) throw std::runtime_error("Maximum number of players already connected!");
-						std::cout << "client_num == " << client_num << std::endl;
-						for (int i = 0; i < cameras.size(); i++) {
-							Scene::Camera *vector_cam = &cameras[i];
-							if (i != (client_num - 1)) {
-								if (i == 0)
-									vector_cam->transform->position = glm::vec3(19.0f, -15.0f, 0.0f);
-								else if (i == 1)
-									vector_cam->transform->position = glm::vec3(19.0f, 21.0f, 0.0f);
-								else if (i == 2)
-									vector_cam->transform->position = glm::vec3(-7.0f, 21.0f, 0.0f);
-								else if (i == 3)
-									vector_cam->transform->position = glm::vec3(-7.0f, -15.0f, 0.0f);
-							}
-						}
-						camera = &cameras[client_num - 1];
-					}
-				}
+	udp_client.poll([this](UDPConnection *c, UDPConnection::Event event){
+		if (event == UDPConnection::OnOpen) {
+			std::cout << "[udp] opened" << std::endl;
+		} else if (event == UDPConnection::OnClose) {
+			//(not fatal; everything just goes over TCP again)
+			std::cout << "[udp] closed" << std::endl;
+			udp_linked = false;
+		} else { assert(event == UDPConnection::OnRecv);
+			//the server only sends data over UDP once it has linked the connection to this client:
+			udp_linked = true;
+			receive_messages(c->recv_buffer);
+		}
+	}, 0.0);
 
-				//the server sent transforms to the client:
-				if (type == 't') {
-					//for getting a float out of a string: https://www.programiz.com/cpp-programming/string-float-conversion
-					//construct position floats
-					float x_pos = std::stof(std::to_string(c->recv_buffer[2]));
-					x_pos += (std::stof(std::to_string(c->recv_buffer[3])) / 100.0f);
-					if (c->recv_buffer[1] == (uint8_t)1) x_pos *= -1.0f;
-					float y_pos = std::stof(std::to_string(c->recv_buffer[5]));
-					y_pos += (std::stof(std::to_string(c->recv_buffer[6])) / 100.0f);
-					if (c->recv_buffer[4] == (uint8_t)1) y_pos *= -1.0f;
-					float z_pos = std::stof(std::to_string(c->recv_buffer[8]));
-					z_pos += (std::stof(std::to_string(c->recv_buffer[9])) / 100.0f);
-					if (c->recv_buffer[7] == (uint8_t)1) z_pos *= -1.0f;
-
-					//set the position of the closest camera:
-					glm::vec3 received_pos = glm::vec3(x_pos, y_pos, z_pos);
-					float curr_dist = 10000.0f;
-					int cam_index = -1;
-					for (int i = 0; i < cameras.size(); i++) {
-						glm::vec3 cam_pos = (&cameras[i])->transform->position;
-						float new_dist = std::sqrt(std::pow(received_pos.x - cam_pos.x, 2) + std::pow(received_pos.y - cam_pos.y, 2) + std::pow(received_pos.z - cam_pos.z, 2));
-						if (new_dist < curr_dist) {
-							curr_dist = new_dist;
-							cam_index = i;
-						}
-					}
-					if (camera != &cameras[cam_index])
-						(&cameras[cam_index])->transform->position = received_pos;
+	//let the server know which snapshot it can use as a baseline:
+	if (ack_tick != NoBaseline) {
+		uint8_t message[1 + 4];
+		message[0] = 'a';
+		put_uint32(ack_tick, message + 1);
+		send_to_server(UDPConnection::UnreliableChannel, message, 1 + 4);
+		ack_tick = NoBaseline;
+	}
 
-					//consume this part of the buffer:
-					c->recv_buffer.erase(c->recv_buffer.begin(), c->recv_buffer.begin() + 10);
+	show_remote_players(elapsed);
+}
 
-					//for debugging:
-					for (int i = 0; i < cameras.size(); i++) {
-						Scene::Camera *vector_cam = &cameras[i];
-						//std::cout << "Camera " << i << " position: " << vector_cam->transform->position.x << ", " << vector_cam->transform->position.y << ", " << vector_cam->transform->position.z << std::endl;
+void PlayMode::show_remote_players(float elapsed) {
+	if (latest_tick == NoBaseline) return;
+
+	//advance render_tick with the clock, easing toward InterpolationDelay behind the newest snapshot:
+	// (so it stays steady when snapshots arrive early or late, but jumps if it gets far off, e.g. at the start)
+	double target = double(latest_tick) - double(InterpolationDelay / ServerTick);
+	render_tick += double(elapsed / ServerTick);
+	if (!render_tick_started || std::abs(render_tick - target) > double(SnapshotHistory / 2)) {
+		render_tick = target;
+		render_tick_started = true;
+	} else {
+		render_tick += 0.05 * (target - render_tick);
+	}
+
+	//find the snapshots just before and just after render_tick:
+	Snapshot const *before = nullptr;
+	Snapshot const *after = nullptr;
+	for (auto const &snapshot : snapshots) {
+		if (double(snapshot.tick) <= render_tick) {
+			if (!before || snapshot.tick > before->tick) before = &snapshot;
+		} else {
+			if (!after || snapshot.tick < after->tick) after = &snapshot;
+		}
+	}
+
+	//player ids match the "Client is player N" numbering, so player N drives camera N-1:
+	for (uint32_t i = 0; i < cameras.size(); ++i) {
+		Scene::Camera &remote = cameras[i];
+		if (camera == &remote) continue;
+		uint16_t id = uint16_t(i + 1);
+		Snapshot::Entry const *from = (before ? before->find(id) : nullptr);
+		Snapshot::Entry const *to = (after ? after->find(id) : nullptr);
+		if (!from && !to) continue;
+
+		glm::vec3 position;
+		glm::quat rotation;
+		if (from && to) {
+			float t = float((render_tick - double(before->tick)) / double(after->tick - before->tick));
+			position = glm::mix(dequantize_position(from->position), dequantize_position(to->position), t);
+			rotation = glm::slerp(unpack_rotation(from->rotation), unpack_rotation(to->rotation), t);
+		} else {
+			//(only one side is known, e.g. the player just came into view, so show that)
+			Snapshot::Entry const *known = (from ? from : to);
+			position = dequantize_position(known->position);
+			rotation = unpack_rotation(known->rotation);
+		}
+		remote.transform->position() = position;
+		//only the heading of remote players is shown, so keep their cylinders upright:
+		glm::vec3 euler = quaternion_to_euler(rotation);
+		euler.x = 90.0f;
+		euler.y = 0.0f;
+		remote.transform->rotation() = euler_to_quaternion(euler);
+	}
+}
+
+void PlayMode::receive_messages(RingBuffer &recv_buffer) {
+	//expecting message(s) like 'm' + 3-byte length + length bytes of text, 's' + a snapshot of player transforms, 'r' + where this player's inputs took it, or 'u' + UDP link token:
+	while (recv_buffer.size() >= 1) {
+		char type = recv_buffer[0];
+		if (!(type == 'm' || type == 's' || type == 'r' || type == 'u')) {
+			throw std::runtime_error("Server sent unknown message type '" + std::to_string(type) + "'");
+		}
+
+		//the server sent a message to the client:
+		if (type == 'm')
+		{
+			if (recv_buffer.size() < 4) break; //if message header isn't here, can't process
+			uint32_t size = (
+				(uint32_t(recv_buffer[1]) << 16) | (uint32_t(recv_buffer[2]) << 8) | (uint32_t(recv_buffer[3]))
+				);
+			if (recv_buffer.size() < 4 + size) break; //if whole message isn't here, can't process
+			//whole message *is* here, so set current server message:
+			server_message.resize(size);
+			recv_buffer.peek(4, &server_message[0], size);
+
+			//and consume this part of the buffer:
+			recv_buffer.consume(4 + size);
+
+			//for when the player is it:
+			if (time_it == 5000.0f && server_message == "You are it! Tag someone!")
+				time_it = 0.0f;
+
+			//for help with finding if a string contains a substring: https://stackoverflow.com/questions/2340281/check-if-a-string-contains-a-string-in-c
+			if (camera == nullptr && server_message.find("Client is player ") != std::string::npos) {
+				//for help with getting an int from a string: https://stackoverflow.com/questions/4442658/c-parse-int-from-string
+				std::cout << server_message << std::endl;
+				if (server_message == "Client is player 1")
+					client_num = 1;
+				else if (server_message == "Client is player 2")
+					client_num = 2;
+				else if (server_message == "Client is player 3")
+					client_num = 3;
+				else if (server_message == "Client is player 4")
+					client_num = 4;
+				if (client_num == -1) throw std::runtime_error("Maximum number of players already connected!");
+				std::cout << "client_num == " << client_num << std::endl;
+				for (int i = 0; i < cameras.size(); i++) {
+					Scene::Camera *vector_cam = &cameras[i];
+					if (i != (client_num - 1)) {
+						if (i == 0)
+							vector_cam->transform->position() = glm::vec3(19.0f, -15.0f, 0.0f);
+						else if (i == 1)
+							vector_cam->transform->position() = glm::vec3(19.0f, 21.0f, 0.0f);
+						else if (i == 2)
+							vector_cam->transform->position() = glm::vec3(-7.0f, 21.0f, 0.0f);
+						else if (i == 3)
+							vector_cam->transform->position() = glm::vec3(-7.0f, -15.0f, 0.0f);
 					}
 				}
+				camera = &cameras[client_num - 1];
 			}
 		}
-	}, 0.0);
+
+		//the server sent a token for linking the UDP connection to this client:
+		if (type == 'u') {
+			if (recv_buffer.size() < 1 + 4) break; //if whole message isn't here, can't process
+			char message[1 + 4];
+			recv_buffer.peek(0, message, 1 + 4);
+			recv_buffer.consume(1 + 4);
+			//(the server starts sending over UDP once it gets this back that way)
+			udp_client.connection.send_reliable(ReliableChannel, message, 1 + 4);
+		}
+
+		//the server sent a snapshot of every player's transform:
+		if (type == 's') {
+			Snapshot snapshot;
+			bool got_snapshot = snapshot.decode(&recv_buffer, [this](uint32_t tick) -> Snapshot const * {
+				Snapshot const &baseline = snapshots[tick % SnapshotHistory];
+				return (baseline.tick == tick ? &baseline : nullptr);
+			});
+			if (!got_snapshot) break; //if whole message isn't here, can't process
+
+			//keep it around as a baseline for future snapshots (unless a newer one already took its place):
+			uint32_t tick = snapshot.tick;
+			Snapshot &slot = snapshots[tick % SnapshotHistory];
+			if (slot.tick <= tick) slot = snapshot;
+
+			//(snapshots can arrive over either connection, so older ones are dropped)
+			if (latest_tick != NoBaseline && tick <= latest_tick) continue;
+			latest_tick = tick;
+			ack_tick = tick;
+			//(remote players are moved in show_remote_players(), a little behind the newest snapshot)
+		}
+
+		//the server says which of this player's inputs it has applied, and where they took the player:
+		if (type == 'r') {
+			if (recv_buffer.size() < ReconcileBytes) break; //if whole message isn't here, can't process
+			uint8_t message[ReconcileBytes];
+			recv_buffer.peek(0, message, ReconcileBytes);
+			recv_buffer.consume(ReconcileBytes);
+
+			//(these can arrive over either connection, so older ones are dropped)
+			uint32_t seq = get_uint32(message + 1);
+			if (seq <= acked_input || camera == nullptr) continue;
+			acked_input = seq;
+			while (!pending_inputs.empty() && pending_inputs.front().seq <= seq) {
+				pending_inputs.pop_front();
+			}
+
+			//reconcile: start from where the server put the player and re-apply the inputs it hasn't seen yet:
+			glm::vec3 position = dequantize_position(glm::u16vec3(get_uint16(message + 5), get_uint16(message + 7), get_uint16(message + 9)));
+			for (auto const &pending : pending_inputs) {
+				position = move_player(position, pending.input, pending.speed, obstacles);
+			}
+			camera->transform->position() = position;
+		}
+	}
+}
+
+void PlayMode::send_to_server(uint8_t channel, void const *data, size_t size) {
+	if (udp_linked && udp_client.connection) {
+		if (channel != UDPConnection::UnreliableChannel) {
+			udp_client.connection.send_reliable(channel, data, size);
+			return;
+		}
+		if (udp_client.connection.send_unreliable(data, size)) return;
+	}
+	client.connection.send_raw(data, size);
 }
 
 void PlayMode::draw(glm::uvec2 const &drawable_size) {
@@ -369,20 +444,12 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 		//update camera aspect ratio for drawable:
 		camera->aspect = float(drawable_size.x) / float(drawable_size.y);
 
-		//set up light type and position for lit_color_texture_program:
-		// TODO: consider using the Light(s) in the scene to do this
-		glUseProgram(lit_color_texture_program->program);
-		glUniform1i(lit_color_texture_program->LIGHT_TYPE_int, 1);
-		GL_ERRORS();
-		glUniform3fv(lit_color_texture_program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f, -1.0f)));
-		GL_ERRORS();
-		glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.95f)));
-		GL_ERRORS();
-		glUseProgram(0);
-
 		glEnable(GL_DEPTH_TEST);
 		glDepthFunc(GL_LESS); //this is the default depth comparison function, but FYI you can change it.
 
+		//bring every moved transform's world matrix up to date at once (scene.draw() then just looks them up):
+		scene.update_world(&world_pool);
+
 		if (time_since_connection >= 0.2f)
 			scene.draw(*camera);
 	}
@@ -471,10 +538,3 @@ glm::vec3 PlayMode::quaternion_to_euler(glm::quat quaternion) {
 	return euler;
 }
 //end of code from my game 3 / Wikipedia
-
-uint8_t PlayMode::absolute_float_to_uint8_t(float f) {
-	f = std::abs(f);
-	int tens = (int)f % 10;
-	int ones = (int)f - (tens * 10);
-	return tens * 10 + ones;
-}
@@ -1,16 +1,21 @@
 #include "Mode.hpp"
 
 #include "Connection.hpp"
+#include "UDPConnection.hpp"
 
+#include "Movement.hpp"
 #include "Scene.hpp"
+#include "Snapshot.hpp"
+#include "WorkerPool.hpp"
 
 #include <glm/glm.hpp>
 
+#include <algorithm>
 #include <vector>
 #include <deque>
 
 struct PlayMode : Mode {
-	PlayMode(Client &client);
+	PlayMode(Client &client, UDPClient &udp_client);
 	virtual ~PlayMode();
 
 	//functions called by main loop:
@@ -32,14 +37,51 @@ struct PlayMode : Mode {
 	//connection to server:
 	Client &client;
 
+	//UDP connection to server (used once the server has linked it to this client):
+	UDPClient &udp_client;
+	bool udp_linked = false;
+	//reliable UDP channel (for the link token):
+	static constexpr uint8_t ReliableChannel = 1;
+
+	//handle whole messages from the server (from either connection):
+	void receive_messages(RingBuffer &recv_buffer);
+	//send a message to the server -- over UDP (on 'channel') once linked, over TCP until then:
+	void send_to_server(uint8_t channel, void const *data, size_t size);
+
+	//recent snapshots from the server (baselines for delta-encoded snapshots), indexed by tick % SnapshotHistory:
+	std::vector< Snapshot > snapshots = std::vector< Snapshot >(SnapshotHistory);
+	uint32_t latest_tick = NoBaseline; //newest snapshot applied
+	uint32_t ack_tick = NoBaseline; //snapshot to acknowledge after this update
+
+	//remote players are shown as of render_tick (in ticks, so fractional), which trails the newest snapshot by InterpolationDelay:
+	double render_tick = 0.0;
+	bool render_tick_started = false;
+	//move remote players' cameras to where they were at render_tick (blending between the snapshots on either side):
+	void show_remote_players(float elapsed);
+
+	//prediction: controls are turned into one numbered input per MoveStep, applied to this player's camera right away,
+	// and kept until the server reports having applied them (see Movement.hpp):
+	struct PendingInput {
+		uint32_t seq = 0;
+		MoveInput input;
+		float speed = 0.0f; //(as predicted when the input was made)
+	};
+	std::deque< PendingInput > pending_inputs;
+	uint32_t next_input_seq = 1;
+	uint32_t acked_input = 0; //last input the server has applied
+	float input_time = 0.0f; //time not yet turned into inputs
+	uint32_t steps_since_send = 0;
+
 	//keeps track of which player this instance of the client is
 	int client_num = -1;
 
 	//local copy of the game scene (so code can change it during gameplay):
 	Scene scene;
+	//threads for updating the scene's world matrices (only used for depths with lots of transforms):
+	WorkerPool world_pool = WorkerPool(std::min(3U, std::max(1U, std::thread::hardware_concurrency()) - 1));
 
-	//transforms for the roofs; used for building detection:
-	std::list< Scene::Transform* > roof_transforms;
+	//the buildings, which players can't walk into:
+	Obstacles obstacles;
 
 	//camera:
 	std::vector<Scene::Camera> cameras;
@@ -53,9 +95,6 @@ struct PlayMode : Mode {
 	glm::vec3 quaternion_to_euler(glm::quat quaternion);
 	//end of code from my game 3
 
-	//for converting from the absolute value of a float to a uint8_t:
-	uint8_t absolute_float_to_uint8_t(float f);
-
 	//for use in the tag game:
 	bool player_is_it = false;
 	float time_it = 5000.0f;
@@ -0,0 +1,92 @@
+#include "RingBuffer.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+void RingBuffer::peek(size_t offset, void *to_, size_t bytes) const {
+	if (offset > count || bytes > count - offset) {
+		throw std::runtime_error("RingBuffer::peek past end of queued data.");
+	}
+	char *to = reinterpret_cast< char * >(to_);
+	while (bytes > 0) {
+		Span span = front_span(offset);
+		size_t step = std::min(span.size, bytes);
+		std::memcpy(to, span.data, step);
+		to += step;
+		offset += step;
+		bytes -= step;
+	}
+}
+
+void RingBuffer::consume(size_t bytes) {
+	if (bytes > count) {
+		throw std::runtime_error("RingBuffer::consume past end of queued data.");
+	}
+	count -= bytes;
+	if (count == 0) {
+		//start over at the beginning of storage so the free space is one contiguous run:
+		head = 0;
+	} else {
+		head = (head + bytes) & (storage.size() - 1);
+	}
+}
+
+void RingBuffer::append(void const *data_, size_t bytes) {
+	char const *data = reinterpret_cast< char const * >(data_);
+	while (bytes > 0) {
+		Space space = back_space(1);
+		size_t step = std::min(space.size, bytes);
+		std::memcpy(space.data, data, step);
+		commit(step);
+		data += step;
+		bytes -= step;
+	}
+}
+
+RingBuffer::Span RingBuffer::front_span(size_t offset) const {
+	Span span;
+	if (offset >= count) return span;
+	size_t start = (head + offset) & (storage.size() - 1);
+	span.data = storage.data() + start;
+	span.size = std::min(count - offset, storage.size() - start);
+	return span;
+}
+
+RingBuffer::Space RingBuffer::back_space(size_t min_bytes) {
+	reserve_back(min_bytes);
+
+	Space space;
+	size_t tail = (head + count) & (storage.size() - 1);
+	space.data = storage.data() + tail;
+	if (tail < head) {
+		space.size = head - tail;
+	} else {
+		space.size = storage.size() - tail;
+	}
+	assert(space.size >= min_bytes);
+	return space;
+}
+
+void RingBuffer::commit(size_t bytes) {
+	assert(count + bytes <= storage.size());
+	count += bytes;
+}
+
+void RingBuffer::reserve_back(size_t min_bytes) {
+	if (!storage.empty()) {
+		size_t tail = (head + count) & (storage.size() - 1);
+		size_t contiguous = (tail < head || (tail == head && count != 0) ? head - tail : storage.size() - tail);
+		if (contiguous >= min_bytes) return;
+	}
+
+	//either out of room or free space is split around the end of storage; re-pack into (possibly larger) storage:
+	size_t capacity = std::max< size_t >(storage.size(), 64);
+	while (capacity < count + min_bytes) capacity *= 2;
+
+	std::vector< char > packed(capacity);
+	peek(0, packed.data(), count);
+	storage.swap(packed);
+	head = 0;
+}
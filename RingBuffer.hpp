@@ -0,0 +1,75 @@
+#pragma once
+
+/*
+ * RingBuffer is a growable first-in-first-out queue of bytes.
+ *
+ * Bytes are appended at the back and consumed from the front without moving
+ *  the bytes that remain, so pulling a small message off the front of a large
+ *  backlog costs O(message) rather than O(backlog) (as with std::vector::erase).
+ *
+ * Connection uses these for its send and receive queues:
+
+	//check for a whole 10-byte message at the front of the queue:
+	if (c->recv_buffer.size() >= 10 && c->recv_buffer[0] == 'b') {
+		uint8_t message[10];
+		c->recv_buffer.peek(0, message, 10);
+		c->recv_buffer.consume(10);
+	}
+
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct RingBuffer {
+	//(const) view of contiguous bytes inside the buffer:
+	struct Span {
+		char const *data = nullptr;
+		size_t size = 0;
+	};
+	//(mutable) view of contiguous free space at the back of the buffer:
+	struct Space {
+		char *data = nullptr;
+		size_t size = 0;
+	};
+
+	//number of bytes currently queued:
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	//byte at 'offset' from the front (offset must be less than size()):
+	char operator[](size_t offset) const { return storage[(head + offset) & (storage.size() - 1)]; }
+
+	//copy 'bytes' bytes starting at 'offset' from the front into 'to' (without consuming them):
+	// note: will throw if fewer than offset + bytes bytes are queued.
+	void peek(size_t offset, void *to, size_t bytes) const;
+
+	//discard 'bytes' bytes from the front:
+	// note: will throw if fewer than 'bytes' bytes are queued.
+	void consume(size_t bytes);
+
+	//discard everything:
+	void clear() { head = 0; count = 0; }
+
+	//append bytes to the back, growing as needed:
+	void append(void const *data, size_t bytes);
+
+	//largest contiguous run of queued bytes starting at 'offset' from the front:
+	// (shorter than size() - offset when the data wraps around the end of storage)
+	Span front_span(size_t offset = 0) const;
+
+	//contiguous free space at the back, at least 'min_bytes' long (grows storage as needed):
+	// write into it and then call commit() with the number of bytes actually written.
+	Space back_space(size_t min_bytes);
+	void commit(size_t bytes);
+
+	//-- internals ---
+
+	//make sure there is contiguous free space for at least 'min_bytes' after the queued data:
+	void reserve_back(size_t min_bytes);
+
+	std::vector< char > storage; //size is always zero or a power of two
+	size_t head = 0; //index in storage of the first queued byte
+	size_t count = 0; //number of queued bytes
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+ * SPSCQueue is a fixed-capacity, lock-free queue for handing items from
+ *  exactly one producer thread to exactly one consumer thread.
+ *
+ * push() (producer only) returns false instead of waiting when the queue is full;
+ * pop() (consumer only) returns false when the queue is empty.
+
+	SPSCQueue< int > queue(1024);
+	//producer thread:
+	if (!queue.push(7)) { ... keep it and try again later ... }
+	//consumer thread:
+	int item;
+	while (queue.pop(&item)) { ... }
+
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+template< typename T >
+struct SPSCQueue {
+	//(capacity is rounded up to a power of two)
+	SPSCQueue(size_t capacity) {
+		size_t size = 1;
+		while (size < capacity) size *= 2;
+		slots.resize(size);
+		mask = size - 1;
+	}
+
+	//producer: add an item to the back of the queue (unless full):
+	bool push(T &&item) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == slots.size()) return false;
+		slots[t & mask] = std::move(item);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+	bool push(T const &item) {
+		T copy = item;
+		return push(std::move(copy));
+	}
+
+	//consumer: take the item from the front of the queue (unless empty):
+	bool pop(T *item) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) return false;
+		*item = std::move(slots[h & mask]);
+		slots[h & mask] = T(); //(so the queue doesn't hold on to resources the consumer is done with)
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	//internals:
+	std::vector< T > slots;
+	size_t mask = 0;
+	//(head and tail are on separate cache lines so that the two threads don't contend for one line)
+	alignas(64) std::atomic< size_t > head{0}; //next slot to pop (written only by the consumer)
+	alignas(64) std::atomic< size_t > tail{0}; //next slot to push (written only by the producer)
+};
@@ -1,15 +1,25 @@
 #include "Scene.hpp"
 
 #include "gl_errors.hpp"
-#include "read_write_chunk.hpp"
+#include "MappedChunks.hpp"
+#include "WorkerPool.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <fstream>
+#include <stdexcept>
+
+//transforms per chunk when Scene::update_world splits a depth over threads (smaller depths aren't split at all):
+constexpr uint32_t ParallelChunk = 256;
 
 //-------------------------
 
-glm::mat4x3 Scene::Transform::make_local_to_parent() const {
+//(shared by Transform::make_local_to_parent and Scene::update_world)
+static glm::mat4x3 make_local_to_parent(glm::vec3 const &position, glm::quat const &rotation, glm::vec3 const &scale) {
 	//compute:
 	//   translate   *   rotate    *   scale
 	// [ 1 0 0 p.x ]   [       0 ]   [ s.x 0 0 0 ]
@@ -26,6 +36,35 @@ glm::mat4x3 Scene::Transform::make_local_to_parent() const {
 	);
 }
 
+glm::vec3 &Scene::Transform::position() {
+	if (!flat) return local.position;
+	flat->dirty[flat_index] = 1;
+	return flat->positions[flat_index];
+}
+glm::quat &Scene::Transform::rotation() {
+	if (!flat) return local.rotation;
+	flat->dirty[flat_index] = 1;
+	return flat->rotations[flat_index];
+}
+glm::vec3 &Scene::Transform::scale() {
+	if (!flat) return local.scale;
+	flat->dirty[flat_index] = 1;
+	return flat->scales[flat_index];
+}
+glm::vec3 const &Scene::Transform::position() const {
+	return (flat ? flat->positions[flat_index] : local.position);
+}
+glm::quat const &Scene::Transform::rotation() const {
+	return (flat ? flat->rotations[flat_index] : local.rotation);
+}
+glm::vec3 const &Scene::Transform::scale() const {
+	return (flat ? flat->scales[flat_index] : local.scale);
+}
+
+glm::mat4x3 Scene::Transform::make_local_to_parent() const {
+	return ::make_local_to_parent(position(), rotation(), scale());
+}
+
 glm::mat4x3 Scene::Transform::make_parent_to_local() const {
 	//compute:
 	//   1/scale       *    rot^-1   *  translate^-1
@@ -34,6 +73,7 @@ glm::mat4x3 Scene::Transform::make_parent_to_local() const {
 	// [ 0 0 1/s.z 0 ]   [       0 ]   [ 0 0 0 -p.z ]
 	//                   [ 0 0 0 1 ]   [ 0 0 0  1   ]
 
+	glm::vec3 const &scale = this->scale();
 	glm::vec3 inv_scale;
 	//taking some care so that we don't end up with NaN's , just a degenerate matrix, if scale is zero:
 	inv_scale.x = (scale.x == 0.0f ? 0.0f : 1.0f / scale.x);
@@ -41,7 +81,7 @@ glm::mat4x3 Scene::Transform::make_parent_to_local() const {
 	inv_scale.z = (scale.z == 0.0f ? 0.0f : 1.0f / scale.z);
 
 	//compute inverse of rotation:
-	glm::mat3 inv_rot = glm::mat3_cast(glm::inverse(rotation));
+	glm::mat3 inv_rot = glm::mat3_cast(glm::inverse(rotation()));
 
 	//scale the rows of rot:
 	inv_rot[0] *= inv_scale;
@@ -52,23 +92,241 @@ glm::mat4x3 Scene::Transform::make_parent_to_local() const {
 		inv_rot[0],
 		inv_rot[1],
 		inv_rot[2],
-		inv_rot * -position
+		inv_rot * -position()
 	);
 }
 
-glm::mat4x3 Scene::Transform::make_local_to_world() const {
-	if (!parent) {
-		return make_local_to_parent();
+//bring flat transform i's world matrix up to date, assuming its parent's already is:
+static void update_flat(Scene::FlatTransforms &f, uint32_t i) {
+	uint32_t p = f.parents[i];
+	uint32_t parent_version = (p == Scene::FlatTransforms::NoParent ? 0 : f.versions[p]);
+
+	//nothing has changed since the last time? (the common case, e.g., for a static city)
+	if (f.versions[i] != 0 && !f.dirty[i] && f.parent_versions[i] == parent_version) return;
+
+	glm::mat4x3 local_to_parent = make_local_to_parent(f.positions[i], f.rotations[i], f.scales[i]);
+	if (p == Scene::FlatTransforms::NoParent) {
+		f.local_to_world[i] = local_to_parent;
 	} else {
-		return parent->make_local_to_world() * glm::mat4(make_local_to_parent()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		f.local_to_world[i] = f.local_to_world[p] * glm::mat4(local_to_parent); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
 	}
+	f.dirty[i] = 0;
+	f.parent_versions[i] = parent_version;
+	f.versions[i] += 1;
+	if (f.versions[i] == 0) f.versions[i] = 1; //(0 means "never computed")
 }
-glm::mat4x3 Scene::Transform::make_world_to_local() const {
+
+//...or after doing the same for its ancestors:
+static void update_flat_chain(Scene::FlatTransforms &f, uint32_t i) {
+	if (f.parents[i] != Scene::FlatTransforms::NoParent) update_flat_chain(f, f.parents[i]);
+	update_flat(f, i);
+}
+
+void Scene::Transform::update_world_cache() const {
+	if (flat) {
+		update_flat_chain(*flat, flat_index);
+		return;
+	}
+
+	WorldCache &cache = world_cache;
+	uint32_t parent_version = (parent ? parent->world_version() : 0);
+
+	//nothing has changed since the last time? (the common case, e.g., for a static city)
+	if (cache.version != 0
+	 && cache.position == local.position && cache.rotation == local.rotation && cache.scale == local.scale
+	 && cache.parent == parent && cache.parent_version == parent_version) {
+		return;
+	}
+
 	if (!parent) {
-		return make_parent_to_local();
+		cache.local_to_world = make_local_to_parent();
 	} else {
-		return make_parent_to_local() * glm::mat4(parent->make_world_to_local()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		cache.local_to_world = parent->make_local_to_world() * glm::mat4(make_local_to_parent()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+	}
+	cache.position = local.position;
+	cache.rotation = local.rotation;
+	cache.scale = local.scale;
+	cache.parent = parent;
+	cache.parent_version = parent_version;
+	cache.version += 1;
+	if (cache.version == 0) cache.version = 1; //(0 means "never computed")
+}
+
+uint32_t Scene::Transform::world_version() const {
+	update_world_cache();
+	return (flat ? flat->versions[flat_index] : world_cache.version);
+}
+
+glm::mat4x3 Scene::Transform::make_local_to_world() const {
+	update_world_cache();
+	return (flat ? flat->local_to_world[flat_index] : world_cache.local_to_world);
+}
+glm::mat4x3 Scene::Transform::make_world_to_local() const {
+	uint32_t version = world_version();
+	WorldCache &cache = world_cache;
+	if (cache.world_to_local_version != version) {
+		if (!parent) {
+			cache.world_to_local = make_parent_to_local();
+		} else {
+			cache.world_to_local = make_parent_to_local() * glm::mat4(parent->make_world_to_local()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+		}
+		cache.world_to_local_version = version;
+	}
+	return cache.world_to_local;
+}
+
+//-------------------------
+
+void Scene::build_flat() {
+	FlatTransforms f;
+
+	//depth of each transform (roots are at depth zero):
+	std::unordered_map< Transform const *, uint32_t > depths;
+	std::function< uint32_t(Transform const *) > depth_of = [&](Transform const *t) -> uint32_t {
+		auto d = depths.find(t);
+		if (d != depths.end()) return d->second;
+		uint32_t depth = (t->parent ? depth_of(t->parent) + 1 : 0);
+		depths.emplace(t, depth);
+		return depth;
+	};
+	uint32_t levels = 0;
+	for (auto const &t : transforms) {
+		levels = std::max(levels, depth_of(&t) + 1);
+	}
+
+	//order by depth (so parents come before their children), keeping list order within each depth:
+	std::vector< std::vector< Transform * > > by_depth(levels);
+	for (auto &t : transforms) {
+		by_depth[depths.at(&t)].emplace_back(&t);
+	}
+	for (auto const &level : by_depth) {
+		f.level_starts.emplace_back(uint32_t(f.transforms.size()));
+		f.transforms.insert(f.transforms.end(), level.begin(), level.end());
+	}
+	f.level_starts.emplace_back(uint32_t(f.transforms.size()));
+
+	std::unordered_map< Transform const *, uint32_t > index;
+	for (uint32_t i = 0; i < f.transforms.size(); ++i) {
+		index.emplace(f.transforms[i], i);
+	}
+	f.parents.reserve(f.transforms.size());
+	for (Transform *t : f.transforms) {
+		if (t->parent) {
+			auto p = index.find(t->parent);
+			if (p == index.end()) throw std::runtime_error("Transform '" + t->name + "' has a parent that isn't in its scene.");
+			f.parents.emplace_back(p->second);
+		} else {
+			f.parents.emplace_back(FlatTransforms::NoParent);
+		}
+	}
+
+	//move the local values over (from wherever they are now -- possibly the old 'flat'):
+	f.positions.reserve(f.transforms.size());
+	f.rotations.reserve(f.transforms.size());
+	f.scales.reserve(f.transforms.size());
+	for (Transform const *t : f.transforms) {
+		f.positions.emplace_back(t->position());
+		f.rotations.emplace_back(t->rotation());
+		f.scales.emplace_back(t->scale());
+	}
+	f.dirty.assign(f.transforms.size(), 1);
+	f.local_to_world.resize(f.transforms.size());
+	f.versions.assign(f.transforms.size(), 0);
+	f.parent_versions.assign(f.transforms.size(), 0);
+
+	flat = std::move(f);
+	for (uint32_t i = 0; i < flat.transforms.size(); ++i) {
+		Transform &t = *flat.transforms[i];
+		t.flat = &flat;
+		t.flat_index = i;
+		t.world_cache.world_to_local_version = 0; //(versions start over in the new storage)
+	}
+}
+
+void Scene::update_world(WorkerPool *pool) {
+	FlatTransforms &f = flat;
+
+	//run 'fn' over [begin, end) -- split over the pool's threads, if there is a pool:
+	auto for_range = [pool](uint32_t begin, uint32_t end, std::function< void(uint32_t, uint32_t) > const &fn) {
+		if (pool) {
+			pool->parallel_for(end - begin, ParallelChunk, [&](uint32_t b, uint32_t e){ fn(begin + b, begin + e); });
+		} else {
+			fn(begin, end);
+		}
+	};
+
+	//one depth at a time (parents are at the previous depth, so are already up to date):
+	for (uint32_t level = 0; level + 1 < f.level_starts.size(); ++level) {
+		for_range(f.level_starts[level], f.level_starts[level + 1], [&](uint32_t begin, uint32_t end){
+			for (uint32_t i = begin; i < end; ++i) {
+				update_flat(f, i);
+			}
+		});
 	}
+
+	//the drawables' boxes move with their transforms:
+	refit_bvh();
+}
+
+//-------------------------
+
+//world-space box around a drawable's (object-space) bounding box:
+static BVH::Box world_box(Scene::Drawable const &drawable) {
+	glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
+	Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+	glm::vec3 center = object_to_world * glm::vec4(0.5f * (pipeline.min + pipeline.max), 1.0f);
+	glm::vec3 half = 0.5f * (pipeline.max - pipeline.min);
+	//(each world axis gets the extent of the box's corners along it)
+	glm::vec3 extent = glm::abs(object_to_world[0]) * half.x + glm::abs(object_to_world[1]) * half.y + glm::abs(object_to_world[2]) * half.z;
+	return BVH::Box{ center - extent, center + extent };
+}
+
+void Scene::build_bvh() {
+	DrawableBVH &d = drawable_bvh;
+	d = DrawableBVH();
+
+	std::vector< BVH::Box > boxes;
+	for (auto &drawable : drawables) {
+		uint32_t index = uint32_t(d.drawables.size());
+		d.drawables.emplace_back(&drawable);
+		if (drawable.pipeline.min.x <= drawable.pipeline.max.x) {
+			d.bounded.emplace_back(index);
+			boxes.emplace_back(world_box(drawable));
+			d.versions.emplace_back(drawable.transform->world_version());
+		} else {
+			d.unbounded.emplace_back(index);
+		}
+	}
+	d.bvh.build(boxes);
+	d.built = true;
+}
+
+void Scene::refit_bvh() const {
+	DrawableBVH &d = drawable_bvh;
+	if (!d.built) return;
+	for (uint32_t item = 0; item < d.bounded.size(); ++item) {
+		Drawable const &drawable = *d.drawables[d.bounded[item]];
+		uint32_t version = drawable.transform->world_version();
+		if (version == d.versions[item]) continue; //(hasn't moved)
+		d.versions[item] = version;
+		d.bvh.update(item, world_box(drawable));
+	}
+	d.bvh.refit();
+}
+
+Scene::Drawable *Scene::pick(glm::vec3 const &origin, glm::vec3 const &direction, float *distance) const {
+	DrawableBVH const &d = drawable_bvh;
+	if (!d.built) return nullptr;
+	Drawable *closest = nullptr;
+	float closest_t = std::numeric_limits< float >::infinity();
+	d.bvh.query_ray(origin, direction, closest_t, [&](uint32_t item, float t){
+		if (t < closest_t) {
+			closest_t = t;
+			closest = d.drawables[d.bounded[item]];
+		}
+	});
+	if (closest && distance) *distance = closest_t;
+	return closest;
 }
 
 //-------------------------
@@ -87,77 +345,465 @@ void Scene::draw(Camera const &camera) const {
 	draw(world_to_clip, world_to_light);
 }
 
+//could any of the box [min,max] (in object space) be visible?
+// conservative: says "no" only if all eight corners are outside the same side of the view volume
+static bool box_may_be_visible(glm::mat4 const &object_to_clip, glm::vec3 const &min, glm::vec3 const &max) {
+	uint32_t outside_all = 0x3f; //sides that every corner so far is outside of
+	for (uint32_t c = 0; c < 8; ++c) {
+		glm::vec4 p = object_to_clip * glm::vec4(
+			(c & 1 ? max.x : min.x),
+			(c & 2 ? max.y : min.y),
+			(c & 4 ? max.z : min.z),
+			1.0f
+		);
+		uint32_t outside = 0;
+		if (p.x < -p.w) outside |= 0x01;
+		if (p.x >  p.w) outside |= 0x02;
+		if (p.y < -p.w) outside |= 0x04;
+		if (p.y >  p.w) outside |= 0x08;
+		if (p.z < -p.w) outside |= 0x10;
+		if (p.z >  p.w) outside |= 0x20;
+		outside_all &= outside;
+		if (outside_all == 0) return true;
+	}
+	return false;
+}
+
+//sort key for drawables: by program, then vertex array, then first two textures, so drawables that share GL state end up next to each other:
+// (names are truncated to 16 bits, which only matters for how well the sort groups things, since binds are checked against the real names)
+static uint64_t state_key(Scene::Drawable::Pipeline const &pipeline) {
+	return (uint64_t(pipeline.program & 0xffff) << 48)
+	     | (uint64_t(pipeline.vao & 0xffff) << 32)
+	     | (uint64_t(pipeline.textures[0].texture & 0xffff) << 16)
+	     | (uint64_t(pipeline.textures[1].texture & 0xffff));
+}
+
+//matrix that takes normals to light space: the inverse transpose of object_to_light's upper 3x3, up to scale --
+// namely its cofactor matrix, which is just three cross products (shaders normalize normals anyway, so the scale doesn't matter):
+static glm::mat3 make_normal_to_light(glm::mat4x3 const &object_to_light) {
+	glm::mat3 m = glm::mat3(object_to_light);
+	glm::mat3 cofactor = glm::mat3(glm::cross(m[1], m[2]), glm::cross(m[2], m[0]), glm::cross(m[0], m[1]));
+	//(the cofactor matrix is the inverse transpose times the determinant, so flip it back for mirrored objects)
+	if (glm::dot(m[0], cofactor[0]) < 0.0f) cofactor = -cofactor;
+	return cofactor;
+}
+
+//can drawables with these pipelines be drawn by the same instanced draw call?
+// (everything but the transform has to match, and custom uniforms can't be per-instance, so those rule it out)
+static bool same_instance_batch(Scene::Drawable::Pipeline const &a, Scene::Drawable::Pipeline const &b) {
+	if (a.program != b.program || a.vao != b.vao) return false;
+	if (a.type != b.type || a.start != b.start || a.count != b.count) return false;
+	if (a.index_type != b.index_type || a.index_start != b.index_start || a.index_count != b.index_count) return false;
+	if (a.position_scale != b.position_scale || a.position_offset != b.position_offset) return false;
+	if (a.InstanceObjectToClip_mat4 != b.InstanceObjectToClip_mat4
+	 || a.InstanceObjectToLight_mat4x3 != b.InstanceObjectToLight_mat4x3
+	 || a.InstanceNormalToLight_mat3 != b.InstanceNormalToLight_mat3
+	 || a.InstanceLightIndices_uvec2 != b.InstanceLightIndices_uvec2) return false;
+	if (a.set_uniforms || b.set_uniforms) return false;
+	for (uint32_t i = 0; i < Scene::Drawable::Pipeline::TextureCount; ++i) {
+		if (a.textures[i].texture != b.textures[i].texture || a.textures[i].target != b.textures[i].target) return false;
+	}
+	return true;
+}
+
+//draw 'instances' copies of a pipeline's vertices (or its indexed range, if it has one):
+static void draw_range(Scene::Drawable::Pipeline const &pipeline, GLsizei instances) {
+	if (pipeline.index_type != 0) {
+		GLbyte *offset = (GLbyte *)0 + size_t(pipeline.index_start) * (pipeline.index_type == GL_UNSIGNED_SHORT ? 2 : 4);
+		if (instances == 1) {
+			glDrawElementsBaseVertex(pipeline.type, pipeline.index_count, pipeline.index_type, offset, pipeline.start);
+		} else {
+			glDrawElementsInstancedBaseVertex(pipeline.type, pipeline.index_count, pipeline.index_type, offset, instances, pipeline.start);
+		}
+	} else {
+		if (instances == 1) {
+			glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+		} else {
+			glDrawArraysInstanced(pipeline.type, pipeline.start, pipeline.count, instances);
+		}
+	}
+}
+
+//what draw() needs to know to check which drawables a light (already in the Frame block) reaches:
+static Scene::LightReach make_light_reach(Scene::LightBlock const &block) {
+	Scene::LightReach reach;
+	reach.location = glm::vec3(block.LOCATION);
+	reach.direction = glm::vec3(block.DIRECTION);
+	reach.energy = std::max(block.ENERGY.x, std::max(block.ENERGY.y, block.ENERGY.z));
+	if (block.TYPE == 1 || block.TYPE == 3) {
+		//hemisphere and directional lights reach everywhere:
+		reach.range = std::numeric_limits< float >::infinity();
+	} else {
+		//point and spot lights fall off with distance squared (but never get brighter than 'energy' -- see the shader):
+		reach.range = std::sqrt(std::max(0.0f, reach.energy) / Scene::MinLightEnergy);
+	}
+	reach.spot = (block.TYPE == 2);
+	reach.cos_cutoff = block.CUTOFF;
+	reach.sin_cutoff = std::sqrt(std::max(0.0f, 1.0f - block.CUTOFF * block.CUTOFF));
+	return reach;
+}
+
+//pack the indices of the lights that reach the sphere at 'center' with 'radius' into 'light_indices' (as in ObjectBlock::LIGHT_INDICES):
+// if more than MaxObjectLights do, keeps the ones that are (roughly) brightest there; returns how many it kept
+static uint32_t select_lights(std::vector< Scene::LightReach > const &lights, glm::vec3 const &center, float radius, uint32_t light_indices[2]) {
+	uint32_t chosen[Scene::MaxObjectLights];
+	float brightness[Scene::MaxObjectLights];
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < lights.size(); ++i) {
+		Scene::LightReach const &light = lights[i];
+
+		float bright = light.energy;
+		if (light.range != std::numeric_limits< float >::infinity()) {
+			glm::vec3 to = center - light.location;
+			float dis = glm::length(to);
+			//skip if too far away:
+			if (dis - radius > light.range) continue;
+			//skip spot lights whose cone misses the sphere:
+			if (light.spot) {
+				float along = glm::dot(to, light.direction);
+				float across = std::sqrt(std::max(0.0f, dis * dis - along * along));
+				if (along < -radius) continue; //(behind the light)
+				if (light.cos_cutoff * across - light.sin_cutoff * along > radius) continue; //(distance from the cone's surface)
+			}
+			float near = std::max(0.0f, dis - radius);
+			bright = light.energy / std::max(1.0f, near * near);
+		}
+
+		if (count < Scene::MaxObjectLights) {
+			chosen[count] = i;
+			brightness[count] = bright;
+			count += 1;
+		} else {
+			//replace the dimmest light chosen so far, if this one is brighter:
+			uint32_t dimmest = 0;
+			for (uint32_t c = 1; c < count; ++c) {
+				if (brightness[c] < brightness[dimmest]) dimmest = c;
+			}
+			if (bright > brightness[dimmest]) {
+				chosen[dimmest] = i;
+				brightness[dimmest] = bright;
+			}
+		}
+	}
+
+	light_indices[0] = light_indices[1] = 0xffffffff; //(all NoLight)
+	for (uint32_t c = 0; c < count; ++c) {
+		light_indices[c / 4] &= ~(0xffU << (8 * (c % 4)));
+		light_indices[c / 4] |= chosen[c] << (8 * (c % 4));
+	}
+	return count;
+}
+
+//point the 'columns' attributes starting at 'location' at one matrix per instance, 'offset' bytes into the instance buffer:
+static void set_instance_matrix(GLuint location, GLuint columns, GLuint rows, size_t offset) {
+	if (location == -1U) return;
+	for (GLuint c = 0; c < columns; ++c) {
+		glVertexAttribPointer(location + c, rows, GL_FLOAT, GL_FALSE, sizeof(Scene::InstanceData), (GLbyte *)0 + offset + c * rows * sizeof(float));
+		glVertexAttribDivisor(location + c, 1);
+		glEnableVertexAttribArray(location + c);
+	}
+}
+
 void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+	draw_counts = DrawCounts();
+
+	//Gather this draw's lights into the Frame block (in light space), along with how far each one reaches:
+	uint32_t light_count = 0;
+	for (auto const &light : lights) {
+		if (light_count == MaxLights) break; //(any more than that are ignored)
+		glm::mat4x3 light_to_world = light.transform->make_local_to_world();
+		LightBlock &block = frame.LIGHTS[light_count];
+		if (light.type == Light::Point) block.TYPE = 0;
+		else if (light.type == Light::Hemisphere) block.TYPE = 1;
+		else if (light.type == Light::Spot) block.TYPE = 2;
+		else block.TYPE = 3; //(Light::Directional)
+		block.CUTOFF = std::cos(0.5f * light.spot_fov);
+		block.LOCATION = glm::vec4(world_to_light * glm::vec4(light_to_world[3], 1.0f), 0.0f);
+		block.DIRECTION = glm::vec4(glm::normalize(world_to_light * glm::vec4(-light_to_world[2], 0.0f)), 0.0f);
+		block.ENERGY = glm::vec4(light.energy, 0.0f);
+		light_count += 1;
+	}
+	if (light_count == 0) {
+		frame.LIGHTS[light_count] = fallback_light;
+		light_count += 1;
+	}
+	light_reach.clear();
+	for (uint32_t i = 0; i < light_count; ++i) {
+		light_reach.emplace_back(make_light_reach(frame.LIGHTS[i]));
+	}
 
-	//Iterate through all drawables, sending each one to OpenGL:
-	for (auto const &drawable : drawables) {
+	//Queue up the drawables that are in view:
+	draw_queue.clear();
+	auto queue_drawable = [&](Drawable const &drawable) {
 		//Reference to drawable's pipeline for convenience:
 		Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
 
 		//skip any drawables without a shader program set:
-		if (pipeline.program == 0) continue;
+		if (pipeline.program == 0) return;
 		//skip any drawables that don't reference any vertex array:
-		if (pipeline.vao == 0) continue;
+		if (pipeline.vao == 0) return;
 		//skip any drawables that don't contain any vertices:
-		if (pipeline.count == 0) continue;
+		if (pipeline.count == 0) return;
+		if (pipeline.index_type != 0 && pipeline.index_count == 0) return;
 
+		//the object-to-world matrix is used in all three of the uniforms below:
+		assert(drawable.transform); //drawables *must* have a transform
+		QueuedDrawable queued;
+		queued.drawable = &drawable;
+		queued.object_to_world = drawable.transform->make_local_to_world();
+		queued.object_to_clip = world_to_clip * glm::mat4(queued.object_to_world);
+
+		//skip any drawables whose bounding box is entirely out of view:
+		if (pipeline.min.x <= pipeline.max.x && !box_may_be_visible(queued.object_to_clip, pipeline.min, pipeline.max)) {
+			draw_counts.culled += 1;
+			return;
+		}
+
+		queued.object_to_light = world_to_light * glm::mat4(queued.object_to_world);
+
+		//figure out which lights reach it (for programs that use the Frame block's lights):
+		queued.light_indices[0] = queued.light_indices[1] = 0xffffffff;
+		if (pipeline.Object_block != -1U || pipeline.InstanceLightIndices_uvec2 != -1U) {
+			//(bounding sphere, in light space; drawables without a bounding box might be anywhere)
+			glm::vec3 center = queued.object_to_light[3];
+			float radius = std::numeric_limits< float >::infinity();
+			if (pipeline.min.x <= pipeline.max.x) {
+				center = queued.object_to_light * glm::vec4(0.5f * (pipeline.min + pipeline.max), 1.0f);
+				float scale = std::max(glm::length(queued.object_to_light[0]), std::max(glm::length(queued.object_to_light[1]), glm::length(queued.object_to_light[2])));
+				radius = 0.5f * glm::length(pipeline.max - pipeline.min) * scale;
+			}
+			draw_counts.object_lights += select_lights(light_reach, center, radius, queued.light_indices);
+		}
+
+		queued.normal_to_light = make_normal_to_light(queued.object_to_light);
+
+		//quantized vertices need scaling back to object space before anything else:
+		// (after the culling and light tests above, which use the object-space bounding box)
+		if (pipeline.position_scale != glm::vec3(1.0f) || pipeline.position_offset != glm::vec3(0.0f)) {
+			glm::mat4 dequantize = glm::mat4(
+				glm::vec4(pipeline.position_scale.x, 0.0f, 0.0f, 0.0f),
+				glm::vec4(0.0f, pipeline.position_scale.y, 0.0f, 0.0f),
+				glm::vec4(0.0f, 0.0f, pipeline.position_scale.z, 0.0f),
+				glm::vec4(pipeline.position_offset, 1.0f)
+			);
+			queued.object_to_clip = queued.object_to_clip * dequantize;
+			queued.object_to_light = queued.object_to_light * dequantize;
+		}
+
+		queued.key = state_key(pipeline);
+		draw_queue.emplace_back(queued);
+	};
+	if (drawable_bvh.built) {
+		//only look at drawables whose world-space boxes the BVH says might be in view (and the ones without boxes):
+		// (refitting first, in case any transforms moved since the last update_world())
+		refit_bvh();
+		DrawableBVH const &d = drawable_bvh;
+		bvh_visible.assign(d.unbounded.begin(), d.unbounded.end());
+		d.bvh.query_frustum(world_to_clip, [&](uint32_t item){
+			bvh_visible.emplace_back(d.bounded[item]);
+		});
+		draw_counts.culled += uint32_t(d.bounded.size() + d.unbounded.size() - bvh_visible.size());
+		std::sort(bvh_visible.begin(), bvh_visible.end()); //(back to scene order)
+		for (uint32_t i : bvh_visible) {
+			queue_drawable(*d.drawables[i]);
+		}
+	} else {
+		for (auto const &drawable : drawables) {
+			queue_drawable(drawable);
+		}
+	}
+
+	//...in state order (stable, so drawables with the same state still draw in scene order):
+	// (instanced drawables come after the rest with the same state, sorted by mesh range, so each batch ends up in one run)
+	std::stable_sort(draw_queue.begin(), draw_queue.end(), [](QueuedDrawable const &a, QueuedDrawable const &b){
+		if (a.key != b.key) return a.key < b.key;
+		Drawable::Pipeline const &pa = a.drawable->pipeline;
+		Drawable::Pipeline const &pb = b.drawable->pipeline;
+		if (pa.instanced() != pb.instanced()) return pb.instanced();
+		if (!pa.instanced()) return false; //(neither is instanced, so keep them in scene order)
+		if (pa.start != pb.start) return pa.start < pb.start;
+		if (pa.count != pb.count) return pa.count < pb.count;
+		if (pa.index_start != pb.index_start) return pa.index_start < pb.index_start;
+		return pa.index_count < pb.index_count;
+	});
+
+	//Gather per-instance matrices for instanced drawables (in queue order, so each batch's are together) and upload them all at once:
+	instance_data.clear();
+	for (auto const &queued : draw_queue) {
+		if (!queued.drawable->pipeline.instanced()) continue;
+		instance_data.emplace_back();
+		InstanceData &data = instance_data.back();
+		data.object_to_clip = queued.object_to_clip;
+		data.object_to_light = queued.object_to_light;
+		data.normal_to_light = queued.normal_to_light;
+		data.light_indices[0] = queued.light_indices[0];
+		data.light_indices[1] = queued.light_indices[1];
+	}
+	if (!instance_data.empty()) {
+		if (instance_buffer == 0) glGenBuffers(1, &instance_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+		glBufferData(GL_ARRAY_BUFFER, instance_data.size() * sizeof(InstanceData), instance_data.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	uint32_t next_instance = 0; //index in instance_data of the next instanced drawable
+
+	//Same for the Object blocks of drawables whose programs read them, each at a properly aligned offset:
+	if (object_stride == 0) {
+		GLint alignment = 0;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		alignment = std::max(alignment, 1);
+		object_stride = GLuint((sizeof(ObjectBlock) + alignment - 1) / alignment * alignment);
+	}
+	object_data.clear();
+	for (auto const &queued : draw_queue) {
+		Drawable::Pipeline const &pipeline = queued.drawable->pipeline;
+		if (pipeline.Object_block == -1U || pipeline.instanced()) continue;
+		ObjectBlock block;
+		block.OBJECT_TO_CLIP = queued.object_to_clip;
+		for (uint32_t c = 0; c < 4; ++c) block.OBJECT_TO_LIGHT[c] = glm::vec4(queued.object_to_light[c], 0.0f);
+		for (uint32_t c = 0; c < 3; ++c) block.NORMAL_TO_LIGHT[c] = glm::vec4(queued.normal_to_light[c], 0.0f);
+		block.LIGHT_INDICES[0] = queued.light_indices[0];
+		block.LIGHT_INDICES[1] = queued.light_indices[1];
+		block.padding[0] = block.padding[1] = 0;
+		object_data.resize(object_data.size() + object_stride, 0);
+		std::memcpy(object_data.data() + object_data.size() - object_stride, &block, sizeof(block));
+	}
+	if (!object_data.empty()) {
+		if (object_buffer == 0) glGenBuffers(1, &object_buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, object_buffer);
+		glBufferData(GL_UNIFORM_BUFFER, object_data.size(), object_data.data(), GL_STREAM_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	uint32_t next_object = 0; //index (in object_stride units) in object_data of the next Object block
+
+	//The Frame block (with the lights gathered above) is the same for everyone:
+	if (frame_buffer == 0) glGenBuffers(1, &frame_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, frame_buffer);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), &frame, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FrameBinding, frame_buffer);
+
+	//GL state set so far, so that calls that wouldn't change anything can be skipped:
+	// (-1U means "unknown", since whatever ran before this may have left anything bound)
+	GLuint bound_program = -1U;
+	GLuint bound_vao = -1U;
+	Drawable::Pipeline::TextureInfo bound_textures[Drawable::Pipeline::TextureCount]; //(texture 0 means nothing bound by this function)
+	GLuint active_texture = -1U;
+	auto set_active_texture = [&](GLuint i) {
+		if (active_texture == i) return;
+		glActiveTexture(GL_TEXTURE0 + i);
+		active_texture = i;
+		draw_counts.state_changes += 1;
+	};
+
+	//Send each one (or, for instanced drawables, each batch) to OpenGL:
+	for (uint32_t q = 0; q < draw_queue.size(); ++q) {
+		QueuedDrawable const &queued = draw_queue[q];
+		Scene::Drawable::Pipeline const &pipeline = queued.drawable->pipeline;
 
 		//Set shader program:
-		glUseProgram(pipeline.program);
+		if (bound_program != pipeline.program) {
+			glUseProgram(pipeline.program);
+			bound_program = pipeline.program;
+			draw_counts.state_changes += 1;
+		}
 
 		//Set attribute sources:
-		glBindVertexArray(pipeline.vao);
+		if (bound_vao != pipeline.vao) {
+			glBindVertexArray(pipeline.vao);
+			bound_vao = pipeline.vao;
+			draw_counts.state_changes += 1;
+		}
+
+		//set up textures (leaving them bound for the next drawable, which probably uses the same ones):
+		// (units this drawable doesn't use are unbound, so it never samples a texture some earlier drawable left there)
+		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+			Drawable::Pipeline::TextureInfo const &want = pipeline.textures[i];
+			Drawable::Pipeline::TextureInfo &bound = bound_textures[i];
+			if (want.texture == bound.texture && (want.texture == 0 || want.target == bound.target)) continue;
+			set_active_texture(i);
+			if (bound.texture != 0 && (want.texture == 0 || bound.target != want.target)) {
+				//(don't leave a texture bound to some other target of this unit, or to a unit that isn't wanted)
+				glBindTexture(bound.target, 0);
+				draw_counts.state_changes += 1;
+			}
+			if (want.texture != 0) {
+				glBindTexture(want.target, want.texture);
+				draw_counts.state_changes += 1;
+			}
+			bound = want;
+		}
+
+		if (pipeline.instanced()) {
+			//the batch is this drawable and any following ones that only differ in transform:
+			uint32_t end = q + 1;
+			while (end < draw_queue.size() && same_instance_batch(pipeline, draw_queue[end].drawable->pipeline)) ++end;
+			uint32_t instances = end - q;
+
+			//point the per-instance attributes at the batch's matrices:
+			size_t base = next_instance * sizeof(InstanceData);
+			glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+			set_instance_matrix(pipeline.InstanceObjectToClip_mat4, 4, 4, base + offsetof(InstanceData, object_to_clip));
+			set_instance_matrix(pipeline.InstanceObjectToLight_mat4x3, 4, 3, base + offsetof(InstanceData, object_to_light));
+			set_instance_matrix(pipeline.InstanceNormalToLight_mat3, 3, 3, base + offsetof(InstanceData, normal_to_light));
+			if (pipeline.InstanceLightIndices_uvec2 != -1U) {
+				GLuint location = pipeline.InstanceLightIndices_uvec2;
+				glVertexAttribIPointer(location, 2, GL_UNSIGNED_INT, sizeof(InstanceData), (GLbyte *)0 + base + offsetof(InstanceData, light_indices));
+				glVertexAttribDivisor(location, 1);
+				glEnableVertexAttribArray(location);
+			}
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+			//draw them all:
+			draw_range(pipeline, instances);
+			draw_counts.drawn += instances;
+			draw_counts.draw_calls += 1;
+
+			next_instance += instances;
+			q = end - 1;
+			continue;
+		}
 
 		//Configure program uniforms:
 
-		//the object-to-world matrix is used in all three of these uniforms:
-		assert(drawable.transform); //drawables *must* have a transform
-		glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
+		//the Object block, if the program reads its matrices from there:
+		if (pipeline.Object_block != -1U) {
+			glBindBufferRange(GL_UNIFORM_BUFFER, ObjectBinding, object_buffer, GLintptr(next_object) * object_stride, sizeof(ObjectBlock));
+			next_object += 1;
+		}
 
 		//OBJECT_TO_CLIP takes vertices from object space to clip space:
 		if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
-			glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
-			glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
+			glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(queued.object_to_clip));
 		}
 
-		//the object-to-light matrix is used in the next two uniforms:
-		glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
-
 		//OBJECT_TO_CLIP takes vertices from object space to light space:
 		if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
-			glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+			glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(queued.object_to_light));
 		}
 
 		//NORMAL_TO_CLIP takes normals from object space to light space:
 		if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
-			glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
-			glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+			glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(queued.normal_to_light));
 		}
 
 		//set any requested custom uniforms:
 		if (pipeline.set_uniforms) pipeline.set_uniforms();
 
-		//set up textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, pipeline.textures[i].texture);
-			}
-		}
-
 		//draw the object:
-		glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+		draw_range(pipeline, 1);
+		draw_counts.drawn += 1;
+		draw_counts.draw_calls += 1;
+	}
 
-		//un-bind textures:
-		for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-			if (pipeline.textures[i].texture != 0) {
-				glActiveTexture(GL_TEXTURE0 + i);
-				glBindTexture(pipeline.textures[i].target, 0);
-			}
+	//un-bind everything (once, at the end):
+	for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+		if (bound_textures[i].texture != 0) {
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(bound_textures[i].target, 0);
 		}
-		glActiveTexture(GL_TEXTURE0);
-
 	}
+	glActiveTexture(GL_TEXTURE0);
 
 	glUseProgram(0);
 	glBindVertexArray(0);
@@ -169,10 +815,12 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 void Scene::load(std::string const &filename,
 	std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
 
-	std::ifstream file(filename, std::ios::binary);
+	//(the file is mapped rather than read, and chunks are looked up by magic number)
+	MappedChunks file(filename);
 
-	std::vector< char > names;
-	read_chunk(file, "str0", &names);
+	MappedChunks::Span< char > names_span = file.get< char >("str0");
+	char const *names_begin = reinterpret_cast< char const * >(names_span.data());
+	std::vector< char > names(names_begin, names_begin + names_span.size()); //(a copy, since load_extra wants one)
 
 	struct HierarchyEntry {
 		uint32_t parent;
@@ -183,8 +831,7 @@ void Scene::load(std::string const &filename,
 		glm::vec3 scale;
 	};
 	static_assert(sizeof(HierarchyEntry) == 4 + 4 + 4 + 4*3 + 4*4 + 4*3, "HierarchyEntry is packed.");
-	std::vector< HierarchyEntry > hierarchy;
-	read_chunk(file, "xfh0", &hierarchy);
+	MappedChunks::Span< HierarchyEntry > hierarchy = file.get< HierarchyEntry >("xfh0");
 
 	struct MeshEntry {
 		uint32_t transform;
@@ -192,8 +839,7 @@ void Scene::load(std::string const &filename,
 		uint32_t name_end;
 	};
 	static_assert(sizeof(MeshEntry) == 4 + 4 + 4, "MeshEntry is packed.");
-	std::vector< MeshEntry > meshes;
-	read_chunk(file, "msh0", &meshes);
+	MappedChunks::Span< MeshEntry > meshes = file.get< MeshEntry >("msh0");
 
 	struct CameraEntry {
 		uint32_t transform;
@@ -202,8 +848,7 @@ void Scene::load(std::string const &filename,
 		float clip_near, clip_far;
 	};
 	static_assert(sizeof(CameraEntry) == 4 + 4 + 4 + 4 + 4, "CameraEntry is packed.");
-	std::vector< CameraEntry > cameras;
-	read_chunk(file, "cam0", &cameras);
+	MappedChunks::Span< CameraEntry > cameras = file.get< CameraEntry >("cam0");
 
 	struct LightEntry {
 		uint32_t transform;
@@ -214,8 +859,7 @@ void Scene::load(std::string const &filename,
 		float fov;
 	};
 	static_assert(sizeof(LightEntry) == 4 + 1 + 3 + 4 + 4 + 4, "LightEntry is packed.");
-	std::vector< LightEntry > lights;
-	read_chunk(file, "lmp0", &lights);
+	MappedChunks::Span< LightEntry > lights = file.get< LightEntry >("lmp0");
 
 
 	//--------------------------------
@@ -240,9 +884,9 @@ void Scene::load(std::string const &filename,
 				throw std::runtime_error("scene file '" + filename + "' contains hierarchy entry with invalid name indices");
 		}
 
-		t->position = h.position;
-		t->rotation = h.rotation;
-		t->scale = h.scale;
+		t->position() = h.position;
+		t->rotation() = h.rotation;
+		t->scale() = h.scale;
 
 		hierarchy_transforms.emplace_back(t);
 	}
@@ -301,10 +945,17 @@ void Scene::load(std::string const &filename,
 		light->spot_fov = l.fov / 180.0f * 3.1415926f; //FOV is stored in degrees; convert to radians.
 	}
 
-	//load any extra that a subclass wants:
-	load_extra(file, names, hierarchy_transforms);
+	//load any extra that a subclass wants (from a stream that starts after whichever standard chunk comes last in the file):
+	std::ifstream extra(filename, std::ios::binary);
+	size_t extra_begin = 0;
+	for (char const *magic : {"str0", "xfh0", "msh0", "cam0", "lmp0"}) {
+		MappedChunks::Chunk const *chunk = file.find(magic);
+		extra_begin = std::max(extra_begin, chunk->offset + chunk->size);
+	}
+	extra.seekg(std::streamoff(extra_begin));
+	load_extra(extra, names, hierarchy_transforms);
 
-	if (file.peek() != EOF) {
+	if (extra.peek() != EOF) {
 		std::cerr << "WARNING: trailing data in scene file '" << filename << "'" << std::endl;
 	}
 
@@ -318,6 +969,15 @@ Scene::Scene(std::string const &filename, std::function< void(Scene &, Transform
 	load(filename, on_drawable);
 }
 
+Scene::~Scene() {
+	for (GLuint *buffer : {&instance_buffer, &frame_buffer, &object_buffer}) {
+		if (*buffer != 0) {
+			glDeleteBuffers(1, buffer);
+			*buffer = 0;
+		}
+	}
+}
+
 Scene::Scene(Scene const &other) {
 	set(other);
 }
@@ -342,9 +1002,9 @@ void Scene::set(Scene const &other, std::unordered_map< Transform const *, Trans
 	for (auto const &t : other.transforms) {
 		transforms.emplace_back();
 		transforms.back().name = t.name;
-		transforms.back().position = t.position;
-		transforms.back().rotation = t.rotation;
-		transforms.back().scale = t.scale;
+		transforms.back().position() = t.position();
+		transforms.back().rotation() = t.rotation();
+		transforms.back().scale() = t.scale();
 		transforms.back().parent = t.parent; //will update later
 
 		//store mapping between transforms old and new:
@@ -374,4 +1034,14 @@ void Scene::set(Scene const &other, std::unordered_map< Transform const *, Trans
 	for (auto &l : lights) {
 		l.transform = transform_to_transform.at(l.transform);
 	}
+
+	fallback_light = other.fallback_light;
+
+	//flat storage and transforms point at each other, so rebuild it (if other had it) rather than copying:
+	flat = FlatTransforms();
+	if (!other.flat.transforms.empty()) build_flat();
+
+	//...same for the drawable BVH:
+	drawable_bvh = DrawableBVH();
+	if (other.drawable_bvh.built) build_bvh();
 }
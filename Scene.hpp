@@ -11,10 +11,12 @@
  */
 
 #include "GL.hpp"
+#include "BVH.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 
+#include <limits>
 #include <list>
 #include <memory>
 #include <functional>
@@ -22,15 +24,24 @@
 #include <vector>
 #include <unordered_map>
 
+struct WorkerPool;
+
 struct Scene {
+	struct FlatTransforms;
+
 	struct Transform {
 		//Transform names are useful for debugging and looking up locations in a loaded scene:
 		std::string name;
 
 		//The core function of a transform is to store a transformation in the world:
-		glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
-		glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f); //n.b. wxyz init order
-		glm::vec3 scale = glm::vec3(1.0f, 1.0f, 1.0f);
+		// (these refer to the transform's own storage, or to its scene's flat storage once build_flat() has been called;
+		//  either way, the references stay valid until the next build_flat(), and the non-const ones mark the transform as changed)
+		glm::vec3 &position();
+		glm::quat &rotation();
+		glm::vec3 &scale();
+		glm::vec3 const &position() const;
+		glm::quat const &rotation() const;
+		glm::vec3 const &scale() const;
 
 		//The transform above may be relative to some parent transform:
 		Transform *parent = nullptr;
@@ -40,6 +51,7 @@ struct Scene {
 		glm::mat4x3 make_local_to_parent() const;
 		glm::mat4x3 make_parent_to_local() const;
 		// ..relative to the world:
+		// (these are cached, and only recomputed when this transform or one of its ancestors has changed)
 		glm::mat4x3 make_local_to_world() const;
 		glm::mat4x3 make_world_to_local() const;
 
@@ -47,6 +59,40 @@ struct Scene {
 		Transform(Transform const &) = delete;
 		//if we delete some constructors, we need to let the compiler know that the default constructor is still okay:
 		Transform() = default;
+
+		//-- internals ---
+		//Where position, rotation, and scale live -- here, until build_flat() moves them to the scene's flat storage (after which 'local' is unused):
+		struct Local {
+			glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f);
+			glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f); //n.b. wxyz init order
+			glm::vec3 scale = glm::vec3(1.0f, 1.0f, 1.0f);
+		} local;
+		FlatTransforms *flat = nullptr; //(once moved: the storage, and this transform's index in it)
+		uint32_t flat_index = 0;
+
+		//The world matrices of transforms in flat storage are cached there (see FlatTransforms); the rest are cached here,
+		// along with the values they were computed from, so the local values and parent can be changed freely --
+		// the cache is checked against them each time a world matrix is asked for:
+		struct WorldCache {
+			//what local_to_world was computed from:
+			glm::vec3 position = glm::vec3(0.0f);
+			glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+			glm::vec3 scale = glm::vec3(0.0f);
+			Transform const *parent = nullptr;
+			uint32_t parent_version = 0; //parent's world_version() at the time
+
+			glm::mat4x3 local_to_world = glm::mat4x3(1.0f);
+			uint32_t version = 0; //bumped each time local_to_world is recomputed (0 = never computed)
+
+			//(used by flat transforms too, whose world_version() comes from the flat storage)
+			glm::mat4x3 world_to_local = glm::mat4x3(1.0f);
+			uint32_t world_to_local_version = 0; //world_version() world_to_local was computed for
+		};
+		mutable WorldCache world_cache;
+		//bring the world matrix up to date (after doing the same for the parent):
+		void update_world_cache() const;
+		//...and return a number that changes each time it is recomputed (never 0):
+		uint32_t world_version() const;
 	};
 
 	struct Drawable {
@@ -65,11 +111,41 @@ struct Scene {
 			GLuint start = 0; //first vertex to draw; passed to glDrawArrays
 			GLuint count = 0; //number of vertices to draw; passed to glDrawArrays
 
+			//...or, for indexed meshes (e.g., from Mesh::index_*), the range of the vao's element array buffer to draw with glDrawElementsBaseVertex:
+			// ('start' is passed as the base vertex)
+			GLenum index_type = 0; //GL_UNSIGNED_SHORT or GL_UNSIGNED_INT (or 0 to use glDrawArrays)
+			GLuint index_start = 0; //first index to draw
+			GLuint index_count = 0; //number of indices to draw
+
+			//for quantized meshes (e.g., from Mesh::position_scale/offset), the object-space position of a vertex is 'position_offset + position_scale * Position':
+			// (draw() folds this into the matrices it hands the program, so programs don't need to know about it; normals aren't scaled)
+			glm::vec3 position_scale = glm::vec3(1.0f);
+			glm::vec3 position_offset = glm::vec3(0.0f);
+
+			//object-space bounding box of those vertices (e.g., from Mesh::min/max), for skipping drawables that are off-screen:
+			// (the default, empty box means "unknown", and such drawables are always drawn)
+			glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+			glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+
 			//uniforms:
 			GLuint OBJECT_TO_CLIP_mat4 = -1U; //uniform location for object to clip space matrix
 			GLuint OBJECT_TO_LIGHT_mat4x3 = -1U; //uniform location for object to light space (== world space) matrix
 			GLuint NORMAL_TO_LIGHT_mat3 = -1U; //uniform location for normal to light space (== world space) matrix
 
+			//...or, for programs that read those matrices from the "Object" uniform block (see ObjectBlock), that block's index:
+			GLuint Object_block = -1U;
+
+			//per-instance attributes (for programs that take the matrices above as attributes instead, like lit_color_texture_instanced_program):
+			// drawables with such a pipeline are drawn with glDrawArraysInstanced (or glDrawElementsInstancedBaseVertex), all at once with any others that share everything but their transform
+			GLuint InstanceObjectToClip_mat4 = -1U; //attribute location for object to clip space matrix
+			GLuint InstanceObjectToLight_mat4x3 = -1U; //attribute location for object to light space matrix
+			GLuint InstanceNormalToLight_mat3 = -1U; //attribute location for normal to light space matrix
+			GLuint InstanceLightIndices_uvec2 = -1U; //attribute location for the lights that reach the drawable (like the Object block's LIGHT_INDICES)
+			bool instanced() const {
+				return InstanceObjectToClip_mat4 != -1U || InstanceObjectToLight_mat4x3 != -1U || InstanceNormalToLight_mat3 != -1U
+				    || InstanceLightIndices_uvec2 != -1U;
+			}
+
 			std::function< void() > set_uniforms; //(optional) function to set any other useful uniforms
 
 			//texture objects to bind for the first TextureCount textures:
@@ -122,12 +198,177 @@ struct Scene {
 	std::list< Camera > cameras;
 	std::list< Light > lights;
 
+	//Flat transform storage (optional):
+	// build_flat() moves every transform's position, rotation, and scale into these arrays (ordered so parents come before
+	// children), and keeps their world matrices here too, so that update_world() can bring every world matrix up to date
+	// in one linear pass over the arrays instead of by chasing pointers through the list.
+	// (the Transforms themselves stay where they are and refer to their entries, so Drawable/Camera/Light pointers keep working)
+	struct FlatTransforms {
+		static constexpr uint32_t NoParent = -1U;
+		std::vector< Transform * > transforms; //ordered by depth: every root, then every child of a root, and so on
+		std::vector< uint32_t > parents; //index of each transform's parent (or NoParent)
+		std::vector< uint32_t > level_starts; //index of the first transform at each depth, then transforms.size()
+		std::vector< glm::vec3 > positions;
+		std::vector< glm::quat > rotations;
+		std::vector< glm::vec3 > scales;
+		std::vector< uint8_t > dirty; //set by Transform's non-const position()/rotation()/scale(); cleared when local_to_world is recomputed
+		std::vector< glm::mat4x3 > local_to_world;
+		std::vector< uint32_t > versions; //bumped each time local_to_world is recomputed (0 = never computed)
+		std::vector< uint32_t > parent_versions; //parent's version when local_to_world was computed
+	} flat;
+
+	//(re)build 'flat' from 'transforms' -- call again after adding or removing transforms or changing a parent:
+	// (n.b. a Scene's transforms point into its 'flat', so a scene that has built it shouldn't be moved; copying is fine)
+	void build_flat();
+
+	//recompute the world matrices (in 'flat') of transforms that changed, or whose ancestors did:
+	// with a 'pool', each depth is split over its threads (depths still go one after another, since children need their parents)
+	void update_world(WorkerPool *pool = nullptr);
+
+	//Drawable BVH (optional):
+	// a BVH over the world-space boxes around drawables' bounding boxes (see Drawable::Pipeline::min/max), which
+	// draw() uses to find what's in view without checking every drawable, and which pick() (or your code) can query.
+	// (drawables without a bounding box aren't in it, and are never culled)
+	struct DrawableBVH {
+		BVH bvh; //item i is drawables[bounded[i]]
+		std::vector< Drawable * > drawables; //every drawable, in scene order
+		std::vector< uint32_t > bounded; //(indices in 'drawables')
+		std::vector< uint32_t > unbounded; //(indices in 'drawables')
+		std::vector< uint32_t > versions; //the world_version() of each item's transform when its box was computed
+		bool built = false;
+	};
+	mutable DrawableBVH drawable_bvh; //(mutable, since draw() refits it)
+
+	//(re)build 'drawable_bvh' -- call again after adding or removing drawables or changing their bounding boxes:
+	void build_bvh();
+
+	//update the boxes of drawables whose transforms moved, and refit the BVH around them:
+	// (update_world() and draw() do this for you; it only recomputes boxes whose transforms' world_version() changed)
+	void refit_bvh() const;
+
+	//the drawable whose (world-space) bounding box the ray 'origin + t * direction' enters first (or nullptr); needs the BVH:
+	// 'distance' gets that t
+	Drawable *pick(glm::vec3 const &origin, glm::vec3 const &direction, float *distance = nullptr) const;
+
+	//Uniform blocks:
+	// programs can declare these (std140) blocks instead of the per-frame and per-drawable uniforms;
+	// draw() fills them in and binds them to these binding points, which programs attach the blocks to with glUniformBlockBinding:
+	enum : GLuint {
+		FrameBinding = 0,
+		ObjectBinding = 1,
+	};
+
+	//Lights:
+	// draw() hands shaders (up to) MaxLights of the scene's lights in the Frame block, and tells each drawable which
+	// (up to) MaxObjectLights of them actually reach it -- so the shader only loops over nearby lights:
+	enum : uint32_t {
+		MaxLights = 64,
+		MaxObjectLights = 8,
+		NoLight = 0xff, //(marks the end of a drawable's light list)
+	};
+	//point and spot lights are considered out of reach where their energy / distance^2 falls below this:
+	static constexpr float MinLightEnergy = 1.0f / 256.0f;
+
+	//"Frame" block (bound once per draw):
+	/*
+		struct Light {
+			int TYPE; //0: point, 1: hemisphere, 2: spot, 3: directional
+			float CUTOFF; //cos of a spot light's half-angle
+			vec3 LOCATION;
+			vec3 DIRECTION;
+			vec3 ENERGY;
+		};
+		layout(std140) uniform Frame {
+			Light LIGHTS[MaxLights];
+		};
+	*/
+	struct LightBlock {
+		int32_t TYPE = 1;
+		float CUTOFF = 1.0f;
+		float padding[2] = {0.0f, 0.0f}; //(std140 puts vec3s on 16-byte boundaries)
+		glm::vec4 LOCATION = glm::vec4(0.0f);
+		glm::vec4 DIRECTION = glm::vec4(0.0f, 0.0f,-1.0f, 0.0f);
+		glm::vec4 ENERGY = glm::vec4(1.0f);
+	};
+	static_assert(sizeof(LightBlock) == 64, "LightBlock should match the std140 layout of the Light struct.");
+	struct FrameBlock {
+		LightBlock LIGHTS[MaxLights];
+	};
+	//the light used when the scene has no Lights (in light space; the default is a white hemisphere light from above):
+	LightBlock fallback_light;
+
+	//"Object" block (one per drawable, all packed into one buffer per draw and bound by range):
+	/*
+		layout(std140) uniform Object {
+			mat4 OBJECT_TO_CLIP;
+			mat4x3 OBJECT_TO_LIGHT;
+			mat3 NORMAL_TO_LIGHT;
+			uvec2 LIGHT_INDICES; //indices in LIGHTS of the lights that reach the drawable, one per byte, ending at the first NoLight
+		};
+	*/
+	struct ObjectBlock {
+		glm::mat4 OBJECT_TO_CLIP;
+		glm::vec4 OBJECT_TO_LIGHT[4]; //(std140 pads each matrix column to a vec4)
+		glm::vec4 NORMAL_TO_LIGHT[3];
+		uint32_t LIGHT_INDICES[2];
+		uint32_t padding[2];
+	};
+	static_assert(sizeof(ObjectBlock) == 192, "ObjectBlock should match the std140 layout of the Object block.");
+
 	//The "draw" function provides a convenient way to pass all the things in a scene to OpenGL:
 	void draw(Camera const &camera) const;
 
 	//..sometimes, you want to draw with a custom projection matrix and/or light space:
 	void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
 
+	//what the most recent draw() did with each drawable -- sent it to OpenGL, or skipped it because its bounding box was outside the view:
+	struct DrawCounts {
+		uint32_t drawn = 0;
+		uint32_t culled = 0;
+		uint32_t state_changes = 0; //program, vertex array, and texture binds it had to make along the way
+		uint32_t draw_calls = 0; //glDraw* calls (fewer than 'drawn' when instancing)
+		uint32_t object_lights = 0; //lights handed to drawables, summed over drawables (i.e., how many lights shaders loop over)
+	};
+	mutable DrawCounts draw_counts;
+
+	//(internals of draw) the drawables in view, sorted so that ones sharing a program/vertex array/textures are drawn together:
+	struct QueuedDrawable {
+		uint64_t key = 0; //program | vao | textures, packed for sorting
+		Drawable const *drawable = nullptr;
+		glm::mat4x3 object_to_world;
+		glm::mat4x3 object_to_light; //(object_to_clip and object_to_light include the pipeline's position_scale/offset)
+		glm::mat4 object_to_clip;
+		glm::mat3 normal_to_light;
+		uint32_t light_indices[2]; //(see ObjectBlock::LIGHT_INDICES)
+	};
+	mutable std::vector< QueuedDrawable > draw_queue; //(kept around so its storage is reused from frame to frame)
+	mutable std::vector< uint32_t > bvh_visible; //(internals of draw) drawables the BVH says might be in view
+	//(internals of draw) per-instance data for instanced pipelines, uploaded once per draw to 'instance_buffer':
+	struct InstanceData {
+		glm::mat4 object_to_clip;
+		glm::mat4x3 object_to_light;
+		glm::mat3 normal_to_light;
+		uint32_t light_indices[2];
+	};
+	mutable std::vector< InstanceData > instance_data;
+	mutable GLuint instance_buffer = 0; //(created by the first draw that needs it)
+	//(internals of draw) this draw's lights (in the same order as the Frame block), with what's needed to check which drawables they reach:
+	struct LightReach {
+		glm::vec3 location;
+		glm::vec3 direction;
+		float range; //(infinite for hemisphere and directional lights)
+		float cos_cutoff, sin_cutoff; //(spot lights only)
+		float energy; //brightest channel
+		bool spot;
+	};
+	mutable FrameBlock frame;
+	mutable std::vector< LightReach > light_reach;
+	//(internals of draw) uniform buffers for the Frame block and the packed Object blocks:
+	mutable std::vector< uint8_t > object_data;
+	mutable GLuint frame_buffer = 0;
+	mutable GLuint object_buffer = 0;
+	mutable GLuint object_stride = 0; //sizeof(ObjectBlock) rounded up to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT (0 = not looked up yet)
+
 	//add transforms/objects/cameras from a scene file to this scene:
 	// the 'on_drawable' callback gives your code a chance to look up mesh data and make Drawables:
 	// throws on file format errors
@@ -136,6 +377,7 @@ struct Scene {
 	);
 
 	//this function is called to read extra chunks from the scene file after the main chunks are read:
+	// ('from' starts right after whichever main chunk comes last in the file, so extra chunks go after all of them)
 	// this is useful if you, e.g., subclassing scene to represent a game level/area
 	virtual void load_extra(std::istream &from, std::vector< char > const &str0, std::vector< Transform * > const &xfh0) { }
 
@@ -145,6 +387,9 @@ struct Scene {
 	//load a scene:
 	Scene(std::string const &filename, std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable);
 
+	//(frees draw()'s buffers, if any)
+	virtual ~Scene();
+
 	//copy a scene (with proper pointer fixup):
 	Scene(Scene const &); //...as a constructor
 	Scene &operator=(Scene const &); //...as scene = scene
@@ -0,0 +1,282 @@
+#include "ShardedServer.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+//room for a few ticks' worth of traffic for a few hundred connections (more spills into the overflow deques):
+constexpr size_t QueueSize = 16384;
+
+//I/O threads aren't woken when commands arrive, so they (and the simulation thread, when waiting for input) poll in short slices:
+constexpr double IOSlice = 0.001;
+
+bool ShardedServer::Shard::receive(Framer const &frame, Connection *c, std::function< void(Input const &) > const &deliver) {
+	auto f = ids.find(c);
+	if (f == ids.end()) return true; //(connection is no longer tracked)
+	Input input;
+	input.type = Input::Message;
+	input.id = f->second;
+	while (c->socket != InvalidSocket && !c->recv_buffer.empty()) { //(the connection may be closed by 'deliver')
+		size_t size = frame(c->recv_buffer);
+		if (size == 0) break;
+		if (size == InvalidMessage || size > MaxMessage || size > c->recv_buffer.size()) {
+			std::cerr << "[ShardedServer] invalid message from connection " << input.id << "; disconnecting." << std::endl;
+			c->close();
+			return false;
+		}
+		input.size = uint8_t(size);
+		c->recv_buffer.peek(0, input.data, size);
+		c->recv_buffer.consume(size);
+		deliver(input);
+	}
+	return true;
+}
+
+void ShardedServer::Shard::forget(Connection *c) {
+	auto f = ids.find(c);
+	if (f == ids.end()) return;
+	by_id.erase(f->second);
+	ids.erase(f);
+}
+
+ShardedServer::Worker::Worker() : commands(QueueSize), inputs(QueueSize) {
+	shard.server = &server;
+}
+
+void ShardedServer::Worker::run(Framer const &frame) {
+	auto deliver = [this](Input const &input) {
+		//(keep order: once anything has overflowed, everything after it waits its turn)
+		if (!(input_overflow.empty() && inputs.push(input))) {
+			input_overflow.emplace_back(input);
+		}
+	};
+	auto report_closed = [&](ConnectionId id) {
+		Input input;
+		input.type = Input::Closed;
+		input.id = id;
+		deliver(input);
+	};
+
+	while (!stop.load(std::memory_order_acquire)) {
+		//pass along inputs that didn't fit last time:
+		while (!input_overflow.empty() && inputs.push(input_overflow.front())) {
+			input_overflow.pop_front();
+		}
+
+		//do what the simulation thread asked:
+		Command command;
+		while (commands.pop(&command)) {
+			if (command.type == Command::Adopt) {
+				try {
+					Connection *c = server.adopt(command.socket);
+					shard.by_id.emplace(command.id, c);
+					shard.ids.emplace(c, command.id);
+				} catch (std::exception &e) {
+					std::cerr << "[ShardedServer] failed to adopt connection " << command.id << ": " << e.what() << std::endl;
+					report_closed(command.id);
+				}
+			} else {
+				auto f = shard.by_id.find(command.id);
+				if (f == shard.by_id.end()) continue; //(already closed)
+				Connection *c = f->second;
+				if (command.type == Command::Send) {
+					c->send_shared(command.data);
+				} else { assert(command.type == Command::Close);
+					c->close();
+					shard.forget(c);
+				}
+			}
+		}
+
+		//receive and send:
+		server.poll([&](Connection *c, Connection::Event evt){
+			if (evt == Connection::OnRecv) {
+				if (!shard.receive(frame, c, deliver)) {
+					report_closed(shard.ids.at(c));
+					shard.forget(c);
+				}
+			} else if (evt == Connection::OnClose) {
+				auto f = shard.ids.find(c);
+				if (f != shard.ids.end()) {
+					report_closed(f->second);
+					shard.forget(c);
+				}
+			}
+		}, IOSlice);
+
+		//publish send queue depth:
+		size_t count = 0, total = 0, max = 0;
+		for (auto const &c : server.connections) {
+			if (c.socket == InvalidSocket) continue;
+			count += 1;
+			total += c.sending_bytes();
+			max = std::max(max, c.sending_bytes());
+		}
+		queued_connections.store(count, std::memory_order_relaxed);
+		queued_total.store(total, std::memory_order_relaxed);
+		queued_max.store(max, std::memory_order_relaxed);
+	}
+}
+
+ShardedServer::ShardedServer(std::string const &port, uint32_t threads, Framer const &frame_) : frame(frame_), listener(port) {
+	inline_shard.server = &listener;
+	for (uint32_t i = 0; i < threads; ++i) {
+		workers.emplace_back(std::make_unique< Worker >());
+	}
+	//(threads start once every worker exists, and never touch 'workers' themselves)
+	for (auto &worker : workers) {
+		Worker *w = worker.get();
+		w->thread = std::thread([this, w](){ w->run(frame); });
+	}
+	std::cout << "[ShardedServer] " << (threads == 0 ? std::string("doing I/O on the main thread") : std::to_string(threads) + " I/O thread(s)") << "." << std::endl;
+}
+
+ShardedServer::~ShardedServer() {
+	for (auto &worker : workers) {
+		worker->stop.store(true, std::memory_order_release);
+	}
+	for (auto &worker : workers) {
+		worker->thread.join();
+	}
+}
+
+void ShardedServer::command(Worker &worker, Command &&command) {
+	//(keep order: once anything has overflowed, everything after it waits its turn)
+	if (!(worker.command_overflow.empty() && worker.commands.push(std::move(command)))) {
+		worker.command_overflow.emplace_back(std::move(command));
+	}
+}
+
+void ShardedServer::poll(std::function< void(ConnectionId id, Connection::Event event, char const *message, size_t size) > const &on_event, double timeout) {
+	if (workers.empty()) {
+		//everything happens right here:
+		listener.poll([&](Connection *c, Connection::Event evt){
+			if (evt == Connection::OnOpen) {
+				ConnectionId id = next_id++;
+				inline_shard.by_id.emplace(id, c);
+				inline_shard.ids.emplace(c, id);
+				if (on_event) on_event(id, Connection::OnOpen, nullptr, 0);
+			} else if (evt == Connection::OnRecv) {
+				bool valid = inline_shard.receive(frame, c, [&](Input const &input){
+					if (on_event) on_event(input.id, Connection::OnRecv, input.data, input.size);
+				});
+				auto f = inline_shard.ids.find(c);
+				if (!valid && f != inline_shard.ids.end()) {
+					ConnectionId id = f->second;
+					inline_shard.forget(c);
+					if (on_event) on_event(id, Connection::OnClose, nullptr, 0);
+				}
+			} else if (evt == Connection::OnClose) {
+				auto f = inline_shard.ids.find(c);
+				if (f != inline_shard.ids.end()) {
+					ConnectionId id = f->second;
+					inline_shard.forget(c);
+					if (on_event) on_event(id, Connection::OnClose, nullptr, 0);
+				}
+			}
+		}, timeout);
+		return;
+	}
+
+	//accept new connections and give each to the least busy worker:
+	listener.poll([&](Connection *c, Connection::Event evt){
+		if (evt != Connection::OnOpen) return; //(connections are released right away, so nothing else happens here)
+		Worker *worker = workers[0].get();
+		for (auto &w : workers) {
+			if (w->connection_count < worker->connection_count) worker = w.get();
+		}
+		ConnectionId id = next_id++;
+		Command adopt;
+		adopt.type = Command::Adopt;
+		adopt.id = id;
+		adopt.socket = listener.release(c);
+		command(*worker, std::move(adopt));
+		worker->connection_count += 1;
+		owners.emplace(id, worker);
+		if (on_event) on_event(id, Connection::OnOpen, nullptr, 0);
+	}, std::min(timeout, IOSlice));
+
+	//handle what the workers received:
+	for (auto &worker : workers) {
+		Input input;
+		while (worker->inputs.pop(&input)) {
+			auto f = owners.find(input.id);
+			if (f == owners.end()) continue; //(closed by this thread already)
+			if (input.type == Input::Message) {
+				if (on_event) on_event(input.id, Connection::OnRecv, input.data, input.size);
+			} else { assert(input.type == Input::Closed);
+				f->second->connection_count -= 1;
+				owners.erase(f);
+				if (on_event) on_event(input.id, Connection::OnClose, nullptr, 0);
+			}
+		}
+	}
+
+	//hand over commands that didn't fit before (sends queued above went straight to the queues if there was room):
+	for (auto &worker : workers) {
+		while (!worker->command_overflow.empty() && worker->commands.push(std::move(worker->command_overflow.front()))) {
+			worker->command_overflow.pop_front();
+		}
+	}
+}
+
+void ShardedServer::send_raw(ConnectionId id, void const *data, size_t size) {
+	if (size == 0) return;
+	auto bytes = std::make_shared< std::vector< char > >(reinterpret_cast< char const * >(data), reinterpret_cast< char const * >(data) + size);
+	send_shared(id, bytes);
+}
+
+void ShardedServer::send_shared(ConnectionId id, Connection::SharedData const &data) {
+	if (workers.empty()) {
+		auto f = inline_shard.by_id.find(id);
+		if (f != inline_shard.by_id.end()) f->second->send_shared(data);
+		return;
+	}
+	auto f = owners.find(id);
+	if (f == owners.end()) return;
+	Command send;
+	send.type = Command::Send;
+	send.id = id;
+	send.data = data;
+	command(*f->second, std::move(send));
+}
+
+void ShardedServer::close(ConnectionId id) {
+	if (workers.empty()) {
+		auto f = inline_shard.by_id.find(id);
+		if (f == inline_shard.by_id.end()) return;
+		Connection *c = f->second;
+		c->close();
+		inline_shard.forget(c);
+		return;
+	}
+	auto f = owners.find(id);
+	if (f == owners.end()) return;
+	Command close;
+	close.type = Command::Close;
+	close.id = id;
+	command(*f->second, std::move(close));
+	f->second->connection_count -= 1;
+	owners.erase(f);
+}
+
+void ShardedServer::sending_bytes(size_t *connections, size_t *total, size_t *max) const {
+	*connections = 0;
+	*total = 0;
+	*max = 0;
+	if (workers.empty()) {
+		for (auto const &c : listener.connections) {
+			if (c.socket == InvalidSocket) continue;
+			*connections += 1;
+			*total += c.sending_bytes();
+			*max = std::max(*max, c.sending_bytes());
+		}
+		return;
+	}
+	for (auto const &worker : workers) {
+		*connections += worker->queued_connections.load(std::memory_order_relaxed);
+		*total += worker->queued_total.load(std::memory_order_relaxed);
+		*max = std::max(*max, worker->queued_max.load(std::memory_order_relaxed));
+	}
+}
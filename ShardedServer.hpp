@@ -0,0 +1,137 @@
+#pragma once
+
+/*
+ * ShardedServer is a (TCP) Server whose connections can be spread over
+ *  several I/O threads, so that receiving, framing, and sending keep up
+ *  with more connections than one core can handle.
+ *
+ * The thread that calls poll() (the "simulation thread") accepts new
+ *  connections and hands each one to the I/O thread with the fewest
+ *  connections. Each I/O thread polls its own connections, splits what
+ *  they receive into whole messages (using the 'frame' function), and
+ *  passes those back through a lock-free single-producer/single-consumer
+ *  queue. Sends go the other way, through another queue per I/O thread.
+ *
+ * With zero I/O threads, everything happens inside poll() on the calling
+ *  thread (just like a plain Server).
+ *
+ * Connections are named by id rather than by Connection * (since the
+ *  Connection objects belong to other threads):
+
+	ShardedServer server("1337", 4, [](RingBuffer const &buffer) -> size_t {
+		//size of the whole message at the front of buffer (0 if incomplete, ShardedServer::InvalidMessage to disconnect)
+	});
+	while (true) {
+		server.poll([&](ShardedServer::ConnectionId id, Connection::Event evt, char const *message, size_t size){
+			if (evt == Connection::OnRecv) {
+				//one whole message
+				server.send_raw(id, "ok", 2);
+			}
+		}, 0.01);
+	}
+
+ */
+
+#include "Connection.hpp"
+#include "SPSCQueue.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct ShardedServer {
+	//(called on I/O threads) size of the whole message at the front of 'buffer':
+	// returns 0 if it hasn't all arrived yet, or InvalidMessage if the connection should be closed
+	typedef std::function< size_t(RingBuffer const &buffer) > Framer;
+	static constexpr size_t InvalidMessage = size_t(-1);
+	//largest message a Framer may report (larger ones are treated as invalid):
+	static constexpr size_t MaxMessage = 64;
+
+	ShardedServer(std::string const &port, uint32_t threads, Framer const &frame);
+	~ShardedServer(); //(stops and joins the I/O threads)
+
+	typedef uint32_t ConnectionId;
+
+	//poll() accepts new connections, reports every whole message received since the last poll,
+	// reports connections that closed, and hands queued sends to the I/O threads:
+	// ('message' and 'size' are only meaningful for OnRecv)
+	void poll(
+		std::function< void(ConnectionId id, Connection::Event event, char const *message, size_t size) > const &connection_event,
+		double timeout = 0.0 //timeout (seconds)
+	);
+
+	//Queue data to send to a connection (ignored if the connection has closed):
+	void send_raw(ConnectionId id, void const *data, size_t size);
+	void send_shared(ConnectionId id, Connection::SharedData const &data);
+
+	//Close a connection (no OnClose is reported for it):
+	void close(ConnectionId id);
+
+	//Bytes waiting to be sent (as of each I/O thread's most recent poll):
+	void sending_bytes(size_t *connections, size_t *total, size_t *max) const;
+
+	//-- internals ---
+	Framer frame;
+	Server listener;
+	ConnectionId next_id = 0;
+
+	//what the simulation thread asks an I/O thread to do:
+	struct Command {
+		enum Type : uint8_t { Adopt, Send, Close } type = Send;
+		ConnectionId id = 0;
+		Socket socket = InvalidSocket; //(Adopt)
+		Connection::SharedData data; //(Send)
+	};
+	//what an I/O thread reports back:
+	struct Input {
+		enum Type : uint8_t { Message, Closed } type = Message;
+		ConnectionId id = 0;
+		uint8_t size = 0;
+		char data[MaxMessage];
+	};
+
+	//connections polled by some thread, and the messages it finds on them:
+	struct Shard {
+		Server *server = nullptr;
+		std::unordered_map< ConnectionId, Connection * > by_id;
+		std::unordered_map< Connection *, ConnectionId > ids;
+
+		//split received data into messages; returns false (after closing the connection) if it was invalid:
+		bool receive(Framer const &frame, Connection *c, std::function< void(Input const &) > const &deliver);
+		void forget(Connection *c);
+	};
+
+	struct Worker {
+		Worker();
+		Server server; //(not listening; only adopts)
+		Shard shard;
+		std::thread thread;
+		std::atomic< bool > stop{false};
+
+		SPSCQueue< Command > commands; //simulation thread -> I/O thread
+		SPSCQueue< Input > inputs; //I/O thread -> simulation thread
+		std::deque< Command > command_overflow; //(simulation thread) commands waiting for room in 'commands'
+		std::deque< Input > input_overflow; //(I/O thread) inputs waiting for room in 'inputs'
+
+		size_t connection_count = 0; //(simulation thread) for choosing the least busy worker
+
+		//send queue depth as of the last poll (written by the I/O thread):
+		std::atomic< size_t > queued_connections{0};
+		std::atomic< size_t > queued_total{0};
+		std::atomic< size_t > queued_max{0};
+
+		void run(Framer const &frame); //the I/O thread's loop
+	};
+	std::vector< std::unique_ptr< Worker > > workers;
+	std::unordered_map< ConnectionId, Worker * > owners; //(simulation thread) which worker has each connection
+
+	Shard inline_shard; //(used when there are no workers)
+
+	void command(Worker &worker, Command &&command);
+};
@@ -0,0 +1,185 @@
+#include "Snapshot.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#include <string>
+
+void Snapshot::sort() {
+	std::sort(entries.begin(), entries.end(), [](Entry const &a, Entry const &b) {
+		return a.id < b.id;
+	});
+}
+
+Snapshot::Entry const *Snapshot::find(uint16_t id) const {
+	auto f = std::lower_bound(entries.begin(), entries.end(), id, [](Entry const &entry, uint16_t id) {
+		return entry.id < id;
+	});
+	if (f == entries.end() || f->id != id) return nullptr;
+	return &*f;
+}
+
+void Snapshot::encode(Snapshot const *baseline, std::vector< char > *to_) const {
+	assert(to_);
+	auto &to = *to_;
+
+	//reserve worst-case space (every entry new, every baseline entry removed) and trim at the end:
+	size_t start = to.size();
+	to.resize(start + 1 + 4 + 4 + 2 + entries.size() * (2 + 1 + TransformBytes) + 2 + (baseline ? baseline->entries.size() * 2 : 0));
+	uint8_t *at = reinterpret_cast< uint8_t * >(to.data() + start);
+
+	*(at++) = 's';
+	put_uint32(tick, at); at += 4;
+	put_uint32(baseline ? baseline->tick : NoBaseline, at); at += 4;
+	uint8_t *count_at = at; at += 2;
+
+	std::vector< uint16_t > removed;
+
+	//walk entries and baseline entries together (both are sorted by id):
+	static Snapshot const empty;
+	auto const &before = (baseline ? baseline->entries : empty.entries);
+	auto b = before.begin();
+	size_t count = 0;
+	for (auto const &entry : entries) {
+		while (b != before.end() && b->id < entry.id) {
+			removed.emplace_back(b->id);
+			++b;
+		}
+
+		uint8_t fields = ChangedAll;
+		if (b != before.end() && b->id == entry.id) {
+			//player was in the baseline, so only send what changed:
+			fields = 0;
+			bool small = true;
+			for (uint32_t i = 0; i < 3; ++i) {
+				if (entry.position[i] != b->position[i]) {
+					fields |= (ChangedX << i);
+					int32_t delta = int32_t(entry.position[i]) - int32_t(b->position[i]);
+					if (delta < -128 || delta > 127) small = false;
+				}
+			}
+			if (entry.rotation != b->rotation) fields |= ChangedRotation;
+			if (small && (fields & (ChangedX | ChangedY | ChangedZ))) fields |= SmallDeltas;
+			++b;
+			if (fields == 0) continue;
+		}
+
+		put_uint16(entry.id, at); at += 2;
+		*(at++) = fields;
+		for (uint32_t i = 0; i < 3; ++i) {
+			if (!(fields & (ChangedX << i))) continue;
+			if (fields & SmallDeltas) {
+				assert(b != before.begin());
+				int32_t delta = int32_t(entry.position[i]) - int32_t((b-1)->position[i]);
+				*(at++) = uint8_t(int8_t(delta));
+			} else {
+				put_uint16(entry.position[i], at); at += 2;
+			}
+		}
+		if (fields & ChangedRotation) {
+			put_uint32(entry.rotation, at); at += 4;
+		}
+		++count;
+	}
+	while (b != before.end()) {
+		removed.emplace_back(b->id);
+		++b;
+	}
+
+	if (count > 0xffff || removed.size() > 0xffff) {
+		throw std::runtime_error("Snapshot has too many entries (" + std::to_string(entries.size()) + ") to encode.");
+	}
+	put_uint16(uint16_t(count), count_at);
+	put_uint16(uint16_t(removed.size()), at); at += 2;
+	for (auto id : removed) {
+		put_uint16(id, at); at += 2;
+	}
+
+	to.resize(at - reinterpret_cast< uint8_t * >(to.data()));
+}
+
+bool Snapshot::decode(RingBuffer *from_, std::function< Snapshot const *(uint32_t tick) > const &find_baseline) {
+	assert(from_);
+	auto &from = *from_;
+
+	size_t offset = 0;
+	uint8_t bytes[2 + 1 + TransformBytes];
+	//peek the next 'count' bytes into 'bytes', if they are there:
+	auto read = [&](size_t count) -> bool {
+		assert(count <= sizeof(bytes));
+		if (from.size() < offset + count) return false;
+		from.peek(offset, bytes, count);
+		offset += count;
+		return true;
+	};
+
+	if (!read(1 + 4 + 4 + 2)) return false;
+	if (bytes[0] != 's') {
+		throw std::runtime_error("Snapshot::decode called on a non-'s' message.");
+	}
+	uint32_t new_tick = get_uint32(bytes + 1);
+	uint32_t baseline_tick = get_uint32(bytes + 5);
+	uint32_t count = get_uint16(bytes + 9);
+
+	Snapshot const *baseline = nullptr;
+	if (baseline_tick != NoBaseline) {
+		baseline = find_baseline(baseline_tick);
+		if (!baseline) {
+			throw std::runtime_error("Snapshot for tick " + std::to_string(new_tick) + " is based on unknown tick " + std::to_string(baseline_tick) + ".");
+		}
+	}
+
+	//start from the baseline and apply changes:
+	// (decoded into a temporary so that nothing changes if the message is incomplete)
+	std::vector< Entry > decoded;
+	if (baseline) decoded = baseline->entries;
+
+	for (uint32_t e = 0; e < count; ++e) {
+		if (!read(2 + 1)) return false;
+		uint16_t id = get_uint16(bytes + 0);
+		uint8_t fields = bytes[2];
+
+		auto f = std::lower_bound(decoded.begin(), decoded.end(), id, [](Entry const &entry, uint16_t id) {
+			return entry.id < id;
+		});
+		if (f == decoded.end() || f->id != id) {
+			if ((fields & ChangedAll) != ChangedAll || (fields & SmallDeltas)) {
+				throw std::runtime_error("Snapshot changes fields of unknown player " + std::to_string(id) + ".");
+			}
+			f = decoded.insert(f, Entry());
+			f->id = id;
+		}
+
+		for (uint32_t i = 0; i < 3; ++i) {
+			if (!(fields & (ChangedX << i))) continue;
+			if (fields & SmallDeltas) {
+				if (!read(1)) return false;
+				f->position[i] = uint16_t(int32_t(f->position[i]) + int8_t(bytes[0]));
+			} else {
+				if (!read(2)) return false;
+				f->position[i] = get_uint16(bytes);
+			}
+		}
+		if (fields & ChangedRotation) {
+			if (!read(4)) return false;
+			f->rotation = get_uint32(bytes);
+		}
+	}
+
+	if (!read(2)) return false;
+	uint32_t removed = get_uint16(bytes);
+	for (uint32_t r = 0; r < removed; ++r) {
+		if (!read(2)) return false;
+		uint16_t id = get_uint16(bytes);
+		auto f = std::lower_bound(decoded.begin(), decoded.end(), id, [](Entry const &entry, uint16_t id) {
+			return entry.id < id;
+		});
+		if (f != decoded.end() && f->id == id) decoded.erase(f);
+	}
+
+	//whole message was here, so commit it:
+	tick = new_tick;
+	entries = std::move(decoded);
+	from.consume(offset);
+	return true;
+}
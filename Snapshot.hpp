@@ -0,0 +1,72 @@
+#pragma once
+
+/*
+ * A Snapshot is the (quantized) state of players at one server tick.
+ *
+ * Each tick, the server builds each client a snapshot of just the players
+ *  near it (its "view"), keeps a short history of the views it sent, and
+ *  sends the current view delta-encoded against the most recent one that
+ *  client has acknowledged (clients reply to each snapshot with 'a' | tick (4 bytes)).
+ *
+ * On the wire, a snapshot is an 's' message:
+ *  's' | tick (4) | baseline tick (4) | count (2) | count x entry | removed count (2) | removed count x id (2)
+ * where each entry is:
+ *  id (2) | fields (1) | [x] [y] [z] [rotation (4)]
+ * 'fields' says which values follow (only changed ones); position values are
+ *  2-byte quantized positions or, with SmallDeltas, 1-byte signed deltas from
+ *  the baseline. Players in neither 'entries' nor 'removed' are unchanged.
+ *  A baseline tick of NoBaseline means the message is a complete snapshot.
+ * (all big-endian, with positions/rotations as in quantize.hpp)
+ */
+
+#include "quantize.hpp"
+#include "RingBuffer.hpp"
+
+#include <vector>
+#include <functional>
+
+struct Snapshot {
+	uint32_t tick = 0;
+
+	struct Entry {
+		uint16_t id = 0; //player id
+		glm::u16vec3 position = glm::u16vec3(0); //from quantize_position()
+		uint32_t rotation = 0; //from pack_rotation()
+	};
+	std::vector< Entry > entries; //sorted by id
+
+	//sort entries by id (call after filling in entries):
+	void sort();
+
+	//entry for player 'id' (or nullptr if there isn't one):
+	Entry const *find(uint16_t id) const;
+
+	//append this snapshot (as an 's' message) to 'to':
+	// delta-encoded against 'baseline', or complete if 'baseline' is nullptr
+	void encode(Snapshot const *baseline, std::vector< char > *to) const;
+
+	//read an 's' message from the front of 'from' into this snapshot:
+	// 'find_baseline' should return the previously decoded snapshot for a given tick
+	// returns false (and consumes nothing) if the whole message hasn't arrived yet
+	// note: will throw if the message isn't an 's' message or its baseline can't be found
+	bool decode(RingBuffer *from, std::function< Snapshot const *(uint32_t tick) > const &find_baseline);
+};
+
+//time between server ticks (one snapshot per tick):
+constexpr float ServerTick = 1.0f / 60.0f; //60fps is almost certainly over-kill, but idk, I like it lol
+
+//baseline tick value for complete snapshots:
+constexpr uint32_t NoBaseline = 0xffffffff;
+
+//how many ticks of snapshots server and client keep around to use as baselines:
+constexpr uint32_t SnapshotHistory = 32;
+
+//'fields' bits for snapshot entries:
+enum : uint8_t {
+	ChangedX = 0x01,
+	ChangedY = 0x02,
+	ChangedZ = 0x04,
+	ChangedRotation = 0x08,
+	SmallDeltas = 0x10,
+	ChangedAll = ChangedX | ChangedY | ChangedZ | ChangedRotation,
+};
@@ -0,0 +1,67 @@
+#include "SpatialGrid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+SpatialGrid::SpatialGrid(glm::vec2 const &min_, glm::vec2 const &max_, float cell_size_) : min(min_), max(max_), cell_size(cell_size_) {
+	if (!(cell_size > 0.0f) || !(max.x > min.x) || !(max.y > min.y)) {
+		throw std::runtime_error("SpatialGrid needs a non-empty rectangle and a positive cell size.");
+	}
+	size = glm::uvec2(
+		uint32_t(std::ceil((max.x - min.x) / cell_size)),
+		uint32_t(std::ceil((max.y - min.y) / cell_size))
+	);
+	cells.resize(size.x * size.y);
+}
+
+glm::uvec2 SpatialGrid::cell_of(glm::vec2 const &position) const {
+	glm::vec2 cell = glm::floor((position - min) / cell_size);
+	return glm::uvec2(
+		uint32_t(std::max(0.0f, std::min(float(size.x - 1), cell.x))),
+		uint32_t(std::max(0.0f, std::min(float(size.y - 1), cell.y)))
+	);
+}
+
+void SpatialGrid::insert(uint32_t id, glm::vec2 const &position) {
+	if (locations.count(id)) {
+		throw std::runtime_error("SpatialGrid already contains id " + std::to_string(id) + ".");
+	}
+	glm::uvec2 at = cell_of(position);
+	uint32_t cell = at.y * size.x + at.x;
+	locations.emplace(id, Location{ cell, uint32_t(cells[cell].size()) });
+	cells[cell].emplace_back(Member{ id, position });
+}
+
+void SpatialGrid::remove(uint32_t id) {
+	auto f = locations.find(id);
+	if (f == locations.end()) {
+		throw std::runtime_error("SpatialGrid doesn't contain id " + std::to_string(id) + ".");
+	}
+	//swap the last member of the cell into this one's slot:
+	std::vector< Member > &members = cells[f->second.cell];
+	uint32_t slot = f->second.slot;
+	if (slot + 1 != members.size()) {
+		members[slot] = members.back();
+		locations.at(members[slot].id).slot = slot;
+	}
+	members.pop_back();
+	locations.erase(f);
+}
+
+void SpatialGrid::move(uint32_t id, glm::vec2 const &position) {
+	auto f = locations.find(id);
+	if (f == locations.end()) {
+		throw std::runtime_error("SpatialGrid doesn't contain id " + std::to_string(id) + ".");
+	}
+	glm::uvec2 at = cell_of(position);
+	uint32_t cell = at.y * size.x + at.x;
+	if (cell == f->second.cell) {
+		//(the common case: still in the same cell)
+		cells[cell][f->second.slot].position = position;
+	} else {
+		remove(id);
+		insert(id, position);
+	}
+}
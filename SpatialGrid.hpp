@@ -0,0 +1,78 @@
+#pragma once
+
+/*
+ * SpatialGrid is a uniform grid of cells over a rectangle of the xy plane,
+ *  for finding which (id-numbered) things are near a point without looking
+ *  at everything.
+ *
+ * Things are inserted once, then moved as they move (which only touches
+ *  the grid when they cross into another cell); positions outside the
+ *  rectangle are clamped into the edge cells.
+ *
+ * The server uses one over the city to decide which players each client
+ *  hears about:
+
+	SpatialGrid grid(glm::vec2(-7.0f, -15.0f), glm::vec2(19.0f, 21.0f), 4.0f);
+	grid.insert(id, position);
+	grid.move(id, new_position);
+	grid.query(center, radius, [&](uint32_t id, glm::vec2 const &position, float distance2){
+		//'id' is within 'radius' of 'center' ('distance2' is the squared distance)
+	});
+
+ */
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+struct SpatialGrid {
+	SpatialGrid(glm::vec2 const &min, glm::vec2 const &max, float cell_size);
+
+	//add, update, or remove a thing:
+	// note: insert() will throw if 'id' is already in the grid, move() and remove() if it isn't
+	void insert(uint32_t id, glm::vec2 const &position);
+	void move(uint32_t id, glm::vec2 const &position);
+	void remove(uint32_t id);
+
+	//call 'fn(id, position, distance2)' for everything within 'radius' of 'center':
+	template< typename F >
+	void query(glm::vec2 const &center, float radius, F const &fn) const;
+
+	//-- internals ---
+	glm::vec2 min, max;
+	float cell_size;
+	glm::uvec2 size; //cells in x and y
+
+	struct Member {
+		uint32_t id;
+		glm::vec2 position;
+	};
+	std::vector< std::vector< Member > > cells; //x-major: cell (x,y) is cells[y * size.x + x]
+
+	struct Location {
+		uint32_t cell; //index in cells
+		uint32_t slot; //index in cells[cell]
+	};
+	std::unordered_map< uint32_t, Location > locations; //where each id is
+
+	//cell coordinates containing a position (clamped to the grid):
+	glm::uvec2 cell_of(glm::vec2 const &position) const;
+};
+
+template< typename F >
+void SpatialGrid::query(glm::vec2 const &center, float radius, F const &fn) const {
+	glm::uvec2 lo = cell_of(center - glm::vec2(radius));
+	glm::uvec2 hi = cell_of(center + glm::vec2(radius));
+	float radius2 = radius * radius;
+	for (uint32_t y = lo.y; y <= hi.y; ++y) {
+		for (uint32_t x = lo.x; x <= hi.x; ++x) {
+			for (auto const &member : cells[y * size.x + x]) {
+				glm::vec2 to = member.position - center;
+				float distance2 = glm::dot(to, to);
+				if (distance2 <= radius2) fn(member.id, member.position, distance2);
+			}
+		}
+	}
+}
@@ -0,0 +1,62 @@
+#include "TickProfiler.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+char const *TickProfiler::phase_name(Phase phase) {
+	switch (phase) {
+		case Receive: return "receive";
+		case Simulate: return "simulate";
+		case Encode: return "encode";
+		case FanOut: return "fan-out";
+		case Send: return "send";
+		default: return "(unknown)";
+	}
+}
+
+void TickProfiler::queue_depths(size_t connections, size_t total, size_t max) {
+	queue_samples += connections;
+	queue_total += total;
+	queue_max = std::max(queue_max, max);
+}
+
+void TickProfiler::end_tick(double late, double busy, double budget) {
+	for (uint32_t p = 0; p < PhaseCount; ++p) {
+		phases[p].add(current[p]);
+		current[p] = 0.0;
+	}
+	lateness.add(std::max(0.0, late));
+	busy_time.add(std::max(0.0, busy));
+	ticks += 1;
+	if (busy > budget) overruns += 1;
+}
+
+void TickProfiler::report(std::ostream &out, double elapsed) {
+	char line[256];
+	std::snprintf(line, sizeof(line), "[server] %.1fs: %d ticks (%.1f/s), %d overruns (%.1f%%)\n",
+		elapsed, int(ticks), (elapsed > 0.0 ? ticks / elapsed : 0.0), int(overruns), (ticks ? 100.0 * overruns / ticks : 0.0));
+	out << line;
+	for (uint32_t p = 0; p < PhaseCount; ++p) {
+		std::snprintf(line, sizeof(line), "\t%-10s %s\n", phase_name(Phase(p)), phases[p].summary_ms().c_str());
+		out << line;
+	}
+	std::snprintf(line, sizeof(line), "\t%-10s %s\n", "late", lateness.summary_ms().c_str());
+	out << line;
+	std::snprintf(line, sizeof(line), "\t%-10s %s\n", "busy", busy_time.summary_ms().c_str());
+	out << line;
+	std::snprintf(line, sizeof(line), "\t%-10s mean %.1fkB max %.1fkB (per connection)\n", "queued",
+		(queue_samples ? queue_total / 1024.0 / queue_samples : 0.0), queue_max / 1024.0);
+	out << line;
+	out.flush();
+
+	for (uint32_t p = 0; p < PhaseCount; ++p) {
+		phases[p].clear();
+	}
+	lateness.clear();
+	busy_time.clear();
+	ticks = 0;
+	overruns = 0;
+	queue_samples = 0;
+	queue_total = 0;
+	queue_max = 0;
+}
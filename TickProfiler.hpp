@@ -0,0 +1,71 @@
+#pragma once
+
+/*
+ * TickProfiler records where the server's time goes each tick:
+ *  per-phase timings, how late each tick started, how long it stayed busy,
+ *  how many ticks overran their budget, and how much data was left queued
+ *  on each connection at the end of the tick.
+ *
+ * Used by server.cpp like:
+
+	{ //time a phase (adds to the current tick's total for that phase):
+		TickProfiler::Scope scope(profiler, TickProfiler::Encode);
+		...
+	}
+	profiler.end_tick(late, busy, ServerTick);
+	if (time to report) profiler.report(std::cout, elapsed);
+
+ */
+
+#include "Histogram.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+struct TickProfiler {
+	enum Phase : uint32_t {
+		Receive, //handling messages from clients (between ticks)
+		Simulate, //updating game state and gathering the snapshot
+		Encode, //serializing snapshots
+		FanOut, //queueing messages on connections
+		Send, //flushing queued messages to sockets
+		PhaseCount
+	};
+	static char const *phase_name(Phase phase);
+
+	//add time to a phase of the current tick:
+	void add(Phase phase, double seconds) { current[phase] += seconds; }
+
+	//times the enclosing block into a phase:
+	struct Scope {
+		Scope(TickProfiler &profiler_, Phase phase_) : profiler(profiler_), phase(phase_), start(std::chrono::steady_clock::now()) { }
+		~Scope() { profiler.add(phase, std::chrono::duration< double >(std::chrono::steady_clock::now() - start).count()); }
+		TickProfiler &profiler;
+		Phase phase;
+		std::chrono::steady_clock::time_point start;
+	};
+
+	//record send queue depth at the end of a tick (number of connections, total bytes queued, most bytes queued on one connection):
+	void queue_depths(size_t connections, size_t total, size_t max);
+
+	//finish the current tick:
+	// 'late' is how long after its deadline the tick started, 'busy' is how long after its deadline its sends finished
+	// (a tick overran if it was still busy when the next tick was due)
+	void end_tick(double late, double busy, double budget);
+
+	//write a summary of everything since the last report, then start over:
+	void report(std::ostream &out, double elapsed);
+
+	//-- internals ---
+	double current[PhaseCount] = { }; //this tick's phase totals
+	Histogram phases[PhaseCount];
+	Histogram lateness;
+	Histogram busy_time;
+	size_t ticks = 0;
+	size_t overruns = 0;
+	size_t queue_samples = 0; //(connections, summed over ticks)
+	size_t queue_total = 0;
+	size_t queue_max = 0;
+};
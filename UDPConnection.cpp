@@ -0,0 +1,507 @@
+
+//--------- OS-specific socket-related headers ---------
+#ifdef _WIN32
+#define _CRT_SECURE_NO_WARNINGS 1 //so we can use strerror()
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN 1
+#endif
+#undef APIENTRY
+#include <winsock2.h>
+#include <ws2tcpip.h> //for getaddrinfo
+#undef max
+#undef min
+
+#pragma comment(lib, "Ws2_32.lib") //link against the winsock2 library
+
+#define MSG_DONTWAIT 0 //on windows, sockets are set to non-blocking with an ioctl
+typedef int ssize_t;
+typedef int socklen_t;
+
+#else
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <fcntl.h>
+
+#define closesocket close
+
+#endif
+
+#include "UDPConnection.hpp"
+
+//------------------------------------------------------
+
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+//first bytes of every packet (so stray traffic is ignored):
+constexpr uint16_t ProtocolId = 0x6736;
+
+constexpr size_t MaxPacket = 1200; //stay under typical path MTU so packets aren't fragmented
+constexpr size_t PacketHeader = 2 + 1 + 2 + 1 + 3 * (UDPConnection::Channels - 1);
+constexpr size_t MessageHeader = 1 + 2 + 2;
+static_assert(PacketHeader + MessageHeader + UDPConnection::MaxMessage <= MaxPacket, "MaxMessage should fit in a packet.");
+
+constexpr double ResendInterval = 0.1; //seconds before an unacknowledged reliable message is sent again
+constexpr double KeepaliveInterval = 1.0; //seconds of silence before an empty packet is sent
+constexpr double ConnectInterval = 0.1; //(client) keepalive interval until the server has responded
+constexpr double Timeout = 10.0; //seconds of silence before a connection is dropped
+
+//reliable messages too far ahead of next_expected are dropped rather than buffered:
+constexpr uint16_t MaxEarly = 1024;
+
+static double steady_now() {
+	return std::chrono::duration< double >(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//is sequence number 'a' after 'b' (allowing for wrap-around)?
+static bool sequence_after(uint16_t a, uint16_t b) {
+	return int16_t(uint16_t(a - b)) > 0;
+}
+
+static void put_uint16(uint16_t value, uint8_t *to) {
+	to[0] = uint8_t(value >> 8);
+	to[1] = uint8_t(value);
+}
+static uint16_t get_uint16(uint8_t const *from) {
+	return uint16_t((uint16_t(from[0]) << 8) | uint16_t(from[1]));
+}
+
+//make a socket non-blocking:
+static void set_nonblocking(Socket s) {
+	#ifdef _WIN32
+	unsigned long one = 1;
+	if (ioctlsocket(s, FIONBIO, &one) != 0) {
+		throw std::runtime_error("failed to make UDP socket non-blocking");
+	}
+	#else
+	int flags = fcntl(s, F_GETFL, 0);
+	if (flags < 0 || fcntl(s, F_SETFL, flags | O_NONBLOCK) < 0) {
+		throw std::system_error(errno, std::system_category(), "failed to make UDP socket non-blocking");
+	}
+	#endif
+}
+
+//wait (until timeout) for a socket to become readable:
+static void wait_readable(char const *where, Socket s, double timeout) {
+	fd_set read_fds;
+	FD_ZERO(&read_fds);
+	FD_SET(s, &read_fds);
+	struct timeval tv;
+	tv.tv_sec = std::lround(std::floor(timeout));
+	tv.tv_usec = std::lround((timeout - std::floor(timeout)) * 1e6);
+	//NOTE: on windows nfds is ignored -- https://msdn.microsoft.com/en-us/library/windows/desktop/ms740141(v=vs.85).aspx
+	int ret = select(int(s) + 1, &read_fds, NULL, NULL, &tv);
+	if (ret < 0) {
+		std::cerr << "[" << where << "] Select returned an error; will attempt to read anyway." << std::endl;
+	}
+}
+
+//---------------------------------
+
+bool UDPConnection::send_unreliable(void const *data_, size_t size) {
+	if (size > MaxMessage) return false;
+	char const *data = reinterpret_cast< char const * >(data_);
+	unreliable_queue.emplace_back(data, data + size);
+	return true;
+}
+
+void UDPConnection::send_reliable(uint8_t channel, void const *data_, size_t size) {
+	if (channel == UnreliableChannel || channel >= Channels) {
+		throw std::runtime_error("UDPConnection::send_reliable on non-reliable channel " + std::to_string(int(channel)) + ".");
+	}
+	if (size > MaxMessage) {
+		throw std::runtime_error("UDPConnection::send_reliable message of " + std::to_string(size) + " bytes is longer than MaxMessage.");
+	}
+	char const *data = reinterpret_cast< char const * >(data_);
+	Reliable &r = reliable[channel];
+	r.unacked.emplace_back();
+	r.unacked.back().sequence = r.next_send++;
+	r.unacked.back().data.assign(data, data + size);
+}
+
+bool UDPConnection::receive_packet(uint8_t const *data, size_t size, double now) {
+	if (size < 3 || get_uint16(data) != ProtocolId) return false;
+	if (data[2] == 'B') {
+		closed = true;
+		return false;
+	}
+	if (data[2] != 'D' || size < PacketHeader - 3 * (Channels - 1)) return false;
+
+	last_receive = now;
+
+	uint16_t sequence = get_uint16(data + 3);
+	//unreliable messages are only delivered from packets newer than any seen so far:
+	bool fresh = (!received_any || sequence_after(sequence, newest_sequence));
+	if (fresh) newest_sequence = sequence;
+	received_any = true;
+
+	uint8_t const *at = data + 5;
+	uint8_t const *end = data + size;
+
+	//acknowledgements (everything before 'next expected' arrived):
+	uint32_t acks = *(at++);
+	for (uint32_t a = 0; a < acks; ++a) {
+		if (end - at < 3) return false;
+		uint8_t channel = at[0];
+		uint16_t next_expected = get_uint16(at + 1);
+		at += 3;
+		if (channel == UnreliableChannel || channel >= Channels) continue;
+		Reliable &r = reliable[channel];
+		while (!r.unacked.empty() && sequence_after(next_expected, r.unacked.front().sequence)) {
+			r.unacked.pop_front();
+		}
+	}
+
+	//messages:
+	bool delivered = false;
+	while (at < end) {
+		uint8_t channel = *(at++);
+		if (channel >= Channels) return delivered; //(malformed; drop the rest)
+		uint16_t message_sequence = 0;
+		if (channel != UnreliableChannel) {
+			if (end - at < 2) return delivered;
+			message_sequence = get_uint16(at);
+			at += 2;
+		}
+		if (end - at < 2) return delivered;
+		size_t length = get_uint16(at);
+		at += 2;
+		if (size_t(end - at) < length) return delivered;
+		uint8_t const *message = at;
+		at += length;
+
+		if (channel == UnreliableChannel) {
+			if (fresh) {
+				recv_buffer.append(message, length);
+				delivered = true;
+			}
+			continue;
+		}
+
+		Reliable &r = reliable[channel];
+		r.received_any = true;
+		r.ack_pending = true; //(acknowledge even duplicates, in case the earlier ack was lost)
+		if (message_sequence == r.next_expected) {
+			recv_buffer.append(message, length);
+			delivered = true;
+			r.next_expected += 1;
+			//deliver anything that was waiting on this message:
+			for (auto f = r.early.find(r.next_expected); f != r.early.end(); f = r.early.find(r.next_expected)) {
+				recv_buffer.append(f->second.data(), f->second.size());
+				r.early.erase(f);
+				r.next_expected += 1;
+			}
+		} else if (sequence_after(message_sequence, r.next_expected) && uint16_t(message_sequence - r.next_expected) < MaxEarly) {
+			r.early.emplace(message_sequence, std::vector< char >(message, message + length));
+		} //else a duplicate of something already delivered
+	}
+	return delivered;
+}
+
+void UDPConnection::flush(double now, double keepalive, std::function< void(uint8_t const *data, size_t size) > const &send_packet) {
+	uint8_t packet[MaxPacket];
+	size_t used = 0; //0 means no packet started
+
+	auto start_packet = [&]() {
+		put_uint16(ProtocolId, packet + 0);
+		packet[2] = 'D';
+		put_uint16(next_sequence, packet + 3);
+		next_sequence += 1;
+		//acknowledge every reliable channel that has received something (so a lost ack is repaired by the next packet):
+		uint8_t &acks = packet[5];
+		acks = 0;
+		used = 6;
+		for (uint8_t channel = 1; channel < Channels; ++channel) {
+			Reliable &r = reliable[channel];
+			if (!r.received_any) continue;
+			packet[used] = channel;
+			put_uint16(r.next_expected, packet + used + 1);
+			used += 3;
+			acks += 1;
+			r.ack_pending = false;
+		}
+	};
+	auto finish_packet = [&]() {
+		send_packet(packet, used);
+		last_send = now;
+		used = 0;
+	};
+	auto add_message = [&](uint8_t channel, uint16_t sequence, std::vector< char > const &data) {
+		size_t needed = 1 + (channel != UnreliableChannel ? 2 : 0) + 2 + data.size();
+		if (used != 0 && used + needed > MaxPacket) finish_packet();
+		if (used == 0) start_packet();
+		assert(used + needed <= MaxPacket);
+		packet[used++] = channel;
+		if (channel != UnreliableChannel) {
+			put_uint16(sequence, packet + used);
+			used += 2;
+		}
+		put_uint16(uint16_t(data.size()), packet + used);
+		used += 2;
+		if (!data.empty()) std::memcpy(packet + used, data.data(), data.size());
+		used += data.size();
+	};
+
+	//reliable messages that have never been sent or are due for a resend:
+	for (uint8_t channel = 1; channel < Channels; ++channel) {
+		for (auto &outgoing : reliable[channel].unacked) {
+			if (outgoing.sent >= 0.0 && now - outgoing.sent < ResendInterval) continue;
+			add_message(channel, outgoing.sequence, outgoing.data);
+			outgoing.sent = now;
+		}
+	}
+
+	//unreliable messages go out exactly once:
+	for (auto const &data : unreliable_queue) {
+		add_message(UnreliableChannel, 0, data);
+	}
+	unreliable_queue.clear();
+
+	//make sure acknowledgements and keepalives go out even if there is nothing else to send:
+	if (used == 0) {
+		bool ack_pending = false;
+		for (uint8_t channel = 1; channel < Channels; ++channel) {
+			ack_pending = ack_pending || reliable[channel].ack_pending;
+		}
+		if (ack_pending || now - last_send >= keepalive) start_packet();
+	}
+
+	if (used != 0) finish_packet();
+}
+
+//---------------------------------
+
+UDPServer::UDPServer(std::string const &port) {
+	#ifdef _WIN32
+	{ //init winsock:
+		WSADATA info;
+		if (WSAStartup((2 << 8) | 2, &info) != 0) {
+			throw std::runtime_error("WSAStartup failed.");
+		}
+	}
+	#endif
+
+	{ //use getaddrinfo to look up how to bind to port:
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_flags = AI_PASSIVE;
+
+		struct addrinfo *res = nullptr;
+		int ret = getaddrinfo(NULL, port.c_str(), &hints, &res);
+		if (ret != 0) {
+			throw std::runtime_error("getaddrinfo error: " + std::string(gai_strerror(ret)));
+		}
+
+		std::cout << "[UDPServer::UDPServer] binding to " << port << ":" << std::endl;
+		for (struct addrinfo *info = res; info != nullptr; info = info->ai_next) {
+			Socket s = ::socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+			if (s == InvalidSocket) {
+				std::cout << "\t(failed to create socket: " << strerror(errno) << ")" << std::endl;
+				continue;
+			}
+			int ret = bind(s, info->ai_addr, int(info->ai_addrlen));
+			if (ret < 0) {
+				std::cout << "\t(failed to bind: " << strerror(errno) << ")" << std::endl;
+				closesocket(s);
+				continue;
+			}
+			std::cout << "\tsuccess!" << std::endl;
+
+			socket = s;
+			break;
+		}
+
+		freeaddrinfo(res);
+	}
+
+	if (socket == InvalidSocket) {
+		throw std::runtime_error("Failed to bind UDP socket to port " + port);
+	}
+
+	set_nonblocking(socket);
+}
+
+void UDPServer::poll(std::function< void(UDPConnection *, UDPConnection::Event event) > const &on_event, double timeout) {
+	wait_readable("UDPServer::poll", socket, timeout);
+
+	double now = steady_now();
+
+	//read every waiting packet:
+	std::vector< UDPConnection * > received;
+	while (true) {
+		uint8_t packet[MaxPacket];
+		struct sockaddr_storage from;
+		socklen_t from_size = sizeof(from);
+		ssize_t ret = recvfrom(socket, reinterpret_cast< char * >(packet), MaxPacket, MSG_DONTWAIT, reinterpret_cast< struct sockaddr * >(&from), &from_size);
+		if (ret < 0) break; //(no more packets -- or an error, which for UDP is likely an ICMP message about some earlier send)
+
+		std::string address(reinterpret_cast< char const * >(&from), from_size);
+		auto f = by_address.find(address);
+		if (f == by_address.end()) {
+			//packets from unknown addresses open new connections (if they look like data packets):
+			if (ret < 3 || get_uint16(packet) != ProtocolId || packet[2] != 'D') continue;
+			connections.emplace_back();
+			UDPConnection &c = connections.back();
+			c.address = address;
+			c.last_receive = c.last_send = now;
+			f = by_address.emplace(address, &c).first;
+			std::cerr << "[UDPServer::poll] client connected." << std::endl; //INFO
+			if (on_event) on_event(&c, UDPConnection::OnOpen);
+		}
+
+		UDPConnection &c = *f->second;
+		if (c.closed) continue;
+		if (c.receive_packet(packet, size_t(ret), now)) {
+			if (std::find(received.begin(), received.end(), &c) == received.end()) received.emplace_back(&c);
+		}
+		if (c.closed && on_event) {
+			on_event(&c, UDPConnection::OnClose);
+		}
+	}
+
+	for (auto c : received) {
+		if (!c->closed && on_event) on_event(c, UDPConnection::OnRecv);
+	}
+
+	//drop connections that have gone quiet:
+	for (auto &c : connections) {
+		if (!c.closed && now - c.last_receive > Timeout) {
+			std::cerr << "[UDPServer::poll] client timed out." << std::endl;
+			c.closed = true;
+			if (on_event) on_event(&c, UDPConnection::OnClose);
+		}
+	}
+
+	//send, and reap closed connections:
+	for (auto c = connections.begin(); c != connections.end(); /*later*/) {
+		auto old = c;
+		++c;
+
+		auto send_packet = [&](uint8_t const *data, size_t size) {
+			sendto(socket, reinterpret_cast< char const * >(data), int(size), MSG_DONTWAIT, reinterpret_cast< struct sockaddr const * >(old->address.data()), socklen_t(old->address.size()));
+		};
+
+		if (old->closed) {
+			//let the other end know (best effort):
+			uint8_t bye[3];
+			put_uint16(ProtocolId, bye);
+			bye[2] = 'B';
+			send_packet(bye, 3);
+			by_address.erase(old->address);
+			connections.erase(old);
+		} else {
+			old->flush(now, KeepaliveInterval, send_packet);
+		}
+	}
+}
+
+//---------------------------------
+
+UDPClient::UDPClient(std::string const &host, std::string const &port) : connections(1), connection(connections.front()) {
+	#ifdef _WIN32
+	{ //init winsock:
+		WSADATA info;
+		if (WSAStartup((2 << 8) | 2, &info) != 0) {
+			throw std::runtime_error("WSAStartup failed.");
+		}
+	}
+	#endif
+
+	{ //use getaddrinfo to look up host/port:
+		struct addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_DGRAM;
+		hints.ai_protocol = IPPROTO_UDP;
+
+		struct addrinfo *res = nullptr;
+		int ret = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+		if (ret != 0) {
+			throw std::runtime_error("getaddrinfo error: " + std::string(gai_strerror(ret)));
+		}
+
+		//(a 'connected' UDP socket only exchanges packets with the server, so send()/recv() can be used)
+		for (struct addrinfo *info = res; info != nullptr; info = info->ai_next) {
+			Socket s = ::socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+			if (s == InvalidSocket) continue;
+			if (connect(s, info->ai_addr, int(info->ai_addrlen)) < 0) {
+				closesocket(s);
+				continue;
+			}
+			socket = s;
+			break;
+		}
+
+		freeaddrinfo(res);
+	}
+
+	if (socket == InvalidSocket) {
+		throw std::runtime_error("Failed to create UDP socket for " + host + ":" + port + ".");
+	}
+
+	set_nonblocking(socket);
+
+	connection.last_receive = connection.last_send = steady_now();
+	connection.last_send -= ConnectInterval; //(so the first poll says hello right away)
+}
+
+void UDPClient::poll(std::function< void(UDPConnection *, UDPConnection::Event event) > const &on_event, double timeout) {
+	if (socket == InvalidSocket) return;
+
+	bool closed_here = false; //(closed by the server or a timeout rather than by calling close())
+	double now = steady_now();
+
+	if (!connection.closed) {
+		wait_readable("UDPClient::poll", socket, timeout);
+		now = steady_now();
+
+		bool delivered = false;
+		while (!connection.closed) {
+			uint8_t packet[MaxPacket];
+			ssize_t ret = recv(socket, reinterpret_cast< char * >(packet), MaxPacket, MSG_DONTWAIT);
+			if (ret < 0) break; //(no more packets, or an ICMP error for an earlier send)
+
+			bool was_open = connection.received_any;
+			if (connection.receive_packet(packet, size_t(ret), now)) delivered = true;
+			if (!was_open && connection.received_any && on_event) on_event(&connection, UDPConnection::OnOpen);
+		}
+		if (delivered && !connection.closed && on_event) on_event(&connection, UDPConnection::OnRecv);
+
+		if (!connection.closed && now - connection.last_receive > Timeout) {
+			std::cerr << "[UDPClient::poll] server timed out." << std::endl;
+			connection.closed = true;
+		}
+		closed_here = connection.closed;
+	}
+
+	if (connection.closed) {
+		//let the server know (best effort), and stop using the socket:
+		uint8_t bye[3];
+		put_uint16(ProtocolId, bye);
+		bye[2] = 'B';
+		send(socket, reinterpret_cast< char const * >(bye), 3, MSG_DONTWAIT);
+		closesocket(socket);
+		socket = InvalidSocket;
+		if (closed_here && on_event) on_event(&connection, UDPConnection::OnClose);
+		return;
+	}
+
+	//until the server responds, say hello frequently:
+	double keepalive = (connection.received_any ? KeepaliveInterval : ConnectInterval);
+	connection.flush(now, keepalive, [this](uint8_t const *data, size_t size) {
+		send(socket, reinterpret_cast< char const * >(data), int(size), MSG_DONTWAIT);
+	});
+}
@@ -0,0 +1,144 @@
+#pragma once
+
+/*
+ * UDPConnection is a small message transport over UDP, meant to be used
+ *  alongside a (TCP) Connection for data where freshness matters more than
+ *  completeness, so that one lost packet doesn't hold up everything after it.
+ *
+ * Each connection carries:
+ *  - an unreliable-sequenced channel (send_unreliable): each message is sent
+ *    once, and messages from packets older than the newest packet already
+ *    received are dropped -- the latest value wins, nothing waits on a resend.
+ *  - a few reliable-ordered channels (send_reliable): messages are resent
+ *    until acknowledged and delivered in order within their channel, so a
+ *    lost packet only delays later messages on that same channel.
+ *
+ * Messages are never split across packets, so (just like Connection) whole
+ *  messages show up in recv_buffer. Also like Connection, you don't create
+ *  UDPConnections yourself, but get them from a UDPServer or UDPClient:
+
+	UDPServer server("1337");
+	while (true) {
+		server.poll([](UDPConnection *connection, UDPConnection::Event evt){
+			if (evt == UDPConnection::OnRecv) {
+				//whole messages (from any channel) are in connection->recv_buffer
+			}
+		}, 0.01);
+	}
+
+ * Each packet on the wire is (big-endian):
+ *  protocol id (2) | 'D' | sequence (2) | ack count (1) | ack count x ( channel (1) | next expected sequence (2) )
+ *  followed by messages, each:  channel (1) | [ sequence (2), reliable channels only ] | length (2) | bytes
+ * or, when a connection is closed:  protocol id (2) | 'B'
+ */
+
+#include "Connection.hpp" //for Socket
+#include "RingBuffer.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct UDPConnection {
+	//channel 0 is unreliable-sequenced, channels 1 .. Channels-1 are reliable-ordered:
+	static constexpr uint8_t UnreliableChannel = 0;
+	static constexpr uint8_t Channels = 4;
+
+	//largest message that fits in a single packet:
+	static constexpr size_t MaxMessage = 1024;
+
+	//Queue a message to go out (once) in the next packet:
+	// returns false (and queues nothing) if the message is longer than MaxMessage
+	bool send_unreliable(void const *data, size_t size);
+
+	//Queue a message to be resent until it is acknowledged:
+	// note: will throw if channel isn't a reliable channel or the message is longer than MaxMessage
+	void send_reliable(uint8_t channel, void const *data, size_t size);
+
+	//Call 'close' to mark a connection for discard:
+	void close() { closed = true; }
+
+	//so you can if(connection) ... to check for validity:
+	explicit operator bool() { return !closed; }
+
+	//Whole messages received on any channel are appended to recv_buffer:
+	RingBuffer recv_buffer;
+
+	enum Event {
+		OnOpen,
+		OnRecv,
+		OnClose
+	};
+
+	//internals:
+	bool closed = false;
+	std::string address; //(server side) raw sockaddr bytes of the remote end
+
+	uint16_t next_sequence = 0; //sequence number of the next outgoing packet
+	uint16_t newest_sequence = 0; //newest incoming packet (for dropping stale unreliable messages)
+	bool received_any = false;
+	double last_receive = 0.0; //time (seconds, steady clock) of last incoming packet
+	double last_send = 0.0; //time of last outgoing packet
+
+	std::deque< std::vector< char > > unreliable_queue; //messages for the next packet
+
+	struct Reliable {
+		//outgoing:
+		struct Outgoing {
+			uint16_t sequence = 0;
+			std::vector< char > data;
+			double sent = -1.0; //time last sent (negative if never sent)
+		};
+		std::deque< Outgoing > unacked;
+		uint16_t next_send = 0;
+		//incoming:
+		uint16_t next_expected = 0;
+		std::map< uint16_t, std::vector< char > > early; //messages received ahead of next_expected
+		bool received_any = false;
+		bool ack_pending = false;
+	};
+	Reliable reliable[Channels]; //(reliable[UnreliableChannel] is unused)
+
+	//handle one incoming packet, appending delivered messages to recv_buffer:
+	// returns true if any messages were delivered
+	bool receive_packet(uint8_t const *data, size_t size, double now);
+
+	//build packets for everything that is due to be sent and hand them to 'send_packet':
+	// (sends an empty packet if nothing has been sent in 'keepalive' seconds)
+	void flush(double now, double keepalive, std::function< void(uint8_t const *data, size_t size) > const &send_packet);
+};
+
+struct UDPServer {
+	UDPServer(std::string const &port); //pass the port number to listen on, as a string (servname, really)
+
+	//poll() updates the list of active connections and provides information to your callbacks:
+	// (a connection is opened by the first valid packet from a new address)
+	void poll(
+		std::function< void(UDPConnection *, UDPConnection::Event event) > const &connection_event = nullptr,
+		double timeout = 0.0 //timeout (seconds)
+	);
+
+	std::list< UDPConnection > connections;
+	std::unordered_map< std::string, UDPConnection * > by_address;
+	Socket socket = InvalidSocket;
+};
+
+struct UDPClient {
+	UDPClient(std::string const &host, std::string const &port);
+
+	//poll() checks the status of the connection and provides information to your callbacks:
+	// (OnOpen is reported once the server first responds; until then, poll() keeps saying hello)
+	void poll(
+		std::function< void(UDPConnection *, UDPConnection::Event event) > const &connection_event = nullptr,
+		double timeout = 0.0 //timeout (seconds)
+	);
+
+	std::list< UDPConnection > connections; //will only ever contain exactly one connection
+	UDPConnection &connection; //reference to the only connection in the connections list
+	Socket socket = InvalidSocket;
+};
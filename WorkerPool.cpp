@@ -0,0 +1,71 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+
+WorkerPool::WorkerPool(uint32_t thread_count) {
+	for (uint32_t t = 0; t < thread_count; ++t) {
+		threads.emplace_back([this](){
+			uint32_t seen = 0; //last job this thread worked on
+			std::unique_lock< std::mutex > lock(mutex);
+			while (true) {
+				start.wait(lock, [&](){ return stop || job != seen; });
+				if (stop) return;
+				seen = job;
+				lock.unlock();
+				run_chunks();
+				lock.lock();
+				working -= 1;
+				if (working == 0) done.notify_one();
+			}
+		});
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		stop = true;
+	}
+	start.notify_all();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+void WorkerPool::run_chunks() {
+	while (true) {
+		uint32_t begin = next.fetch_add(chunk, std::memory_order_relaxed);
+		if (begin >= count) return;
+		(*fn)(begin, std::min(count, begin + chunk));
+	}
+}
+
+void WorkerPool::parallel_for(uint32_t count_, uint32_t min_chunk, std::function< void(uint32_t begin, uint32_t end) > const &fn_) {
+	if (count_ == 0) return;
+	min_chunk = std::max(min_chunk, 1U);
+	//not worth waking anyone up:
+	if (threads.empty() || count_ <= min_chunk) {
+		fn_(0, count_);
+		return;
+	}
+
+	//(a few chunks per thread, so threads that start late still get some)
+	uint32_t per_chunk = std::max(min_chunk, count_ / (4 * uint32_t(threads.size() + 1)));
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		fn = &fn_;
+		count = count_;
+		chunk = per_chunk;
+		next.store(0, std::memory_order_relaxed);
+		working = uint32_t(threads.size());
+		job += 1;
+	}
+	start.notify_all();
+
+	run_chunks();
+
+	//wait for the other threads to run out of chunks, too:
+	std::unique_lock< std::mutex > lock(mutex);
+	done.wait(lock, [&](){ return working == 0; });
+	fn = nullptr;
+}
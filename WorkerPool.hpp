@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+ * WorkerPool is a fixed set of threads for splitting a loop over many
+ *  independent items (e.g., the transforms at one depth of a Scene) into
+ *  chunks that run at the same time.
+ *
+ * The calling thread works on chunks too, and parallel_for() returns once
+ *  every chunk is done; loops too small to be worth splitting run right
+ *  there on the calling thread:
+
+	WorkerPool pool(3); //three threads, plus whichever thread calls parallel_for()
+	pool.parallel_for(count, 256, [&](uint32_t begin, uint32_t end){
+		for (uint32_t i = begin; i < end; ++i) { ...item i... }
+	});
+
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct WorkerPool {
+	WorkerPool(uint32_t threads);
+	~WorkerPool(); //(stops and joins the threads)
+
+	//call 'fn(begin, end)' on chunks (of at least 'min_chunk' items) covering [0, count); returns when all are done:
+	// note: only one thread at a time should call parallel_for()
+	void parallel_for(uint32_t count, uint32_t min_chunk, std::function< void(uint32_t begin, uint32_t end) > const &fn);
+
+	//-- internals ---
+	std::vector< std::thread > threads;
+
+	std::mutex mutex;
+	std::condition_variable start; //signaled when a job starts (or the pool stops)
+	std::condition_variable done; //signaled when the last thread finishes with a job
+	uint32_t job = 0; //(guarded by mutex) bumped for each parallel_for()
+	uint32_t working = 0; //(guarded by mutex) pool threads still on the current job
+	bool stop = false; //(guarded by mutex)
+
+	//the current job:
+	std::function< void(uint32_t, uint32_t) > const *fn = nullptr;
+	uint32_t count = 0;
+	uint32_t chunk = 0;
+	std::atomic< uint32_t > next{0}; //start of the next chunk to hand out
+
+	void run_chunks(); //work on chunks of the current job until there are none left
+};
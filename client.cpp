@@ -1,6 +1,7 @@
 #include "PlayMode.hpp"
 
 #include "Connection.hpp"
+#include "UDPConnection.hpp"
 #include "Mode.hpp"
 #include "Load.hpp"
 #include "Sound.hpp"
@@ -28,6 +29,7 @@ int main(int argc, char **argv) {
 
 	//------------ connect to server --------------
 	Client client(argv[1], argv[2]);
+	UDPClient udp_client(argv[1], argv[2]); //(for data that shouldn't wait behind TCP retransmits)
 
 	//------------  initialization ------------
 
@@ -96,7 +98,7 @@ int main(int argc, char **argv) {
 	call_load_functions();
 
 	//------------ create game mode + make current --------------
-	Mode::set_current(std::make_shared< PlayMode >(client));
+	Mode::set_current(std::make_shared< PlayMode >(client, udp_client));
 
 	//------------ main loop ------------
 
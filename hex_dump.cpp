@@ -1,5 +1,7 @@
 #include "hex_dump.hpp"
 
+#include "RingBuffer.hpp"
+
 std::string hex_dump(void const *data, size_t size) {
 	//format of dump will be as per xxd:
 	//0000ADDR: xxxx xxxx xxxx xxxx xxxx xxxx xxxx xxxx  asciitextfordump
@@ -55,3 +57,9 @@ std::string hex_dump(void const *data, size_t size) {
 	}
 	return ret;
 }
+
+std::string hex_dump(RingBuffer const &data) {
+	std::vector< char > bytes(data.size());
+	data.peek(0, bytes.data(), bytes.size());
+	return hex_dump(bytes);
+}
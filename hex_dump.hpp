@@ -3,6 +3,8 @@
 #include <string>
 #include <vector>
 
+struct RingBuffer;
+
 //produce a nicely formatted hex dump of some data:
 std::string hex_dump(void const *data, size_t size);
 
@@ -11,3 +13,6 @@ template< typename T >
 std::string hex_dump(std::vector< T > const &data) {
 	return hex_dump(data.data(), data.size() * sizeof(T));
 }
+
+//helper for usage on queued data (e.g., Connection::recv_buffer):
+std::string hex_dump(RingBuffer const &data);
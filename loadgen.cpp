@@ -0,0 +1,315 @@
+//loadgen: headless bots that stress the game server.
+// Each bot opens a (TCP) Client connection and speaks the same protocol as
+// PlayMode: it wanders the city by sending 'i' inputs (the server moves
+// it and reports back with 'r'), acknowledges snapshots with 'a', and
+// pings with 'p'.
+// Once a second it prints bytes/sec, how regularly snapshots arrive,
+// how late they are, and ping round-trip times.
+
+#include "Connection.hpp"
+#include "Snapshot.hpp"
+#include "Histogram.hpp"
+#include "Movement.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+static double steady_now() {
+	return std::chrono::duration< double >(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//statistics gathered by all bots (reset after every report):
+struct Stats {
+	size_t bytes_in = 0;
+	size_t bytes_out = 0;
+	size_t snapshots = 0;
+	Histogram interval; //time between consecutive snapshots
+	Histogram lag; //how much later than the best-case arrival time a snapshot showed up
+	Histogram rtt; //ping round-trip time
+	uint32_t newest_tick = 0;
+	bool any_tick = false;
+
+	void clear() { *this = Stats(); }
+};
+
+struct Bot {
+	Bot(std::string const &host, std::string const &port, std::mt19937 &mt_) : client(host, port), mt(mt_) {
+		std::uniform_real_distribution< float > angle(0.0f, 6.2831853f);
+		heading = angle(mt);
+	}
+
+	Client client;
+	std::mt19937 &mt;
+
+	//simulated player (the server moves it; 'position' is where the server last said it was):
+	glm::vec3 position = glm::vec3(0.5f * (CityMin + CityMax), PlayerHeight);
+	float heading;
+	uint32_t next_input_seq = 1;
+	double input_time = 0.0; //time covered by the inputs sent so far
+
+	//when to next send each kind of message:
+	double next_move = 0.0;
+	double next_ping = 0.0;
+
+	//snapshot state (as in PlayMode):
+	std::vector< Snapshot > snapshots = std::vector< Snapshot >(SnapshotHistory);
+	uint32_t latest_tick = NoBaseline;
+	double latest_arrival = 0.0;
+	double best_lag = std::numeric_limits< double >::infinity();
+
+	void send(void const *data, size_t size, Stats &stats) {
+		client.connection.send_raw(data, size);
+		stats.bytes_out += size;
+	}
+
+	//send whatever is due and handle anything that arrived:
+	// returns false if the connection has closed
+	bool update(double now, double start, double move_rate, double ping_rate, Stats &stats) {
+		if (move_rate > 0.0 && now >= next_move) {
+			//one input per MoveStep since the last message (as a client would make them):
+			if (input_time == 0.0) input_time = now;
+			uint32_t count = uint32_t(std::min(double(MaxInputsPerMessage), std::floor((now - input_time) / MoveStep)));
+			if (count > 0) {
+				//wander forward, turning a little (and heading back toward the middle near the edges of the city):
+				std::uniform_real_distribution< float > turn(-0.3f, 0.3f);
+				heading += turn(mt);
+				glm::vec2 at = glm::vec2(position);
+				if (at.x < CityMin.x + 1.0f || at.x > CityMax.x - 1.0f || at.y < CityMin.y + 1.0f || at.y > CityMax.y - 1.0f) {
+					glm::vec2 to_middle = 0.5f * (CityMin + CityMax) - at;
+					heading = std::atan2(to_middle.y, to_middle.x);
+				}
+				//(a camera looking along the heading: tipped up from looking down -z, then turned about z)
+				glm::quat rotation = glm::angleAxis(heading - 1.5707963f, glm::vec3(0.0f, 0.0f, 1.0f))
+					* glm::angleAxis(1.5707963f, glm::vec3(1.0f, 0.0f, 0.0f));
+				MoveInput inputs[MaxInputsPerMessage];
+				for (uint32_t i = 0; i < count; ++i) {
+					inputs[i].buttons = MoveUp;
+					inputs[i].rotation = pack_rotation(rotation);
+				}
+
+				uint8_t message[input_message_size(MaxInputsPerMessage)];
+				encode_inputs(next_input_seq, inputs, count, message);
+				send(message, input_message_size(count), stats);
+				next_input_seq += count;
+				input_time += count * double(MoveStep);
+				//(a bot that fell far behind skips ahead rather than sending a burst)
+				input_time = std::max(input_time, now - MaxInputsPerMessage * double(MoveStep));
+			}
+			next_move = now + 1.0 / move_rate;
+		}
+
+		if (ping_rate > 0.0 && now >= next_ping) {
+			uint8_t message[1 + 4];
+			message[0] = 'p';
+			put_uint32(uint32_t(std::lround((now - start) * 1e6)), message + 1);
+			send(message, sizeof(message), stats);
+			next_ping = now + 1.0 / ping_rate;
+		}
+
+		bool open = true;
+		client.poll([&](Connection *c, Connection::Event event){
+			if (event == Connection::OnClose) {
+				open = false;
+			} else if (event == Connection::OnRecv) {
+				stats.bytes_in += receive(c->recv_buffer, now, start, stats);
+			}
+		}, 0.0);
+		return open && client.connection;
+	}
+
+	//handle whole messages; returns the number of bytes consumed:
+	size_t receive(RingBuffer &recv_buffer, double now, double start, Stats &stats) {
+		size_t before = recv_buffer.size();
+		uint32_t ack_tick = NoBaseline;
+		while (recv_buffer.size() >= 1) {
+			char type = recv_buffer[0];
+			if (type == 'm') {
+				if (recv_buffer.size() < 4) break;
+				uint32_t size = (uint32_t(uint8_t(recv_buffer[1])) << 16) | (uint32_t(uint8_t(recv_buffer[2])) << 8) | uint32_t(uint8_t(recv_buffer[3]));
+				if (recv_buffer.size() < 4 + size) break;
+				recv_buffer.consume(4 + size);
+			} else if (type == 'u') {
+				//(bots only use TCP, so the UDP link token is ignored)
+				if (recv_buffer.size() < 1 + 4) break;
+				recv_buffer.consume(1 + 4);
+			} else if (type == 'r') {
+				if (recv_buffer.size() < ReconcileBytes) break;
+				uint8_t message[ReconcileBytes];
+				recv_buffer.peek(0, message, ReconcileBytes);
+				recv_buffer.consume(ReconcileBytes);
+				glm::vec3 reported = dequantize_position(glm::u16vec3(get_uint16(message + 5), get_uint16(message + 7), get_uint16(message + 9)));
+				//(a bot that didn't get anywhere has walked into a building, so turn around)
+				if (glm::length(glm::vec2(reported - position)) < 0.01f) {
+					std::uniform_real_distribution< float > turn(1.5707963f, 4.712389f);
+					heading += turn(mt);
+				}
+				position = reported;
+			} else if (type == 'P') {
+				if (recv_buffer.size() < 1 + 4) break;
+				uint8_t stamp[4];
+				recv_buffer.peek(1, stamp, 4);
+				recv_buffer.consume(1 + 4);
+				uint32_t now_us = uint32_t(std::lround((now - start) * 1e6));
+				stats.rtt.add(double(uint32_t(now_us - get_uint32(stamp))) * 1e-6);
+			} else if (type == 's') {
+				Snapshot snapshot;
+				bool got_snapshot = snapshot.decode(&recv_buffer, [this](uint32_t tick) -> Snapshot const * {
+					Snapshot const &baseline = snapshots[tick % SnapshotHistory];
+					return (baseline.tick == tick ? &baseline : nullptr);
+				});
+				if (!got_snapshot) break;
+				uint32_t tick = snapshot.tick;
+				snapshots[tick % SnapshotHistory] = std::move(snapshot);
+
+				//timing: the best-case arrival time of tick t is (t * ServerTick + some fixed offset),
+				// so lag is measured relative to the earliest arrival this bot has seen:
+				double lag = now - double(tick) * ServerTick;
+				best_lag = std::min(best_lag, lag);
+				stats.lag.add(lag - best_lag);
+				if (latest_tick != NoBaseline) stats.interval.add(now - latest_arrival);
+				latest_tick = tick;
+				latest_arrival = now;
+				ack_tick = tick;
+
+				stats.snapshots += 1;
+				if (!stats.any_tick || tick > stats.newest_tick) stats.newest_tick = tick;
+				stats.any_tick = true;
+			} else {
+				throw std::runtime_error("Server sent unknown message type '" + std::to_string(type) + "'");
+			}
+		}
+
+		if (ack_tick != NoBaseline) {
+			uint8_t message[1 + 4];
+			message[0] = 'a';
+			put_uint32(ack_tick, message + 1);
+			send(message, sizeof(message), stats);
+		}
+
+		return before - recv_buffer.size();
+	}
+};
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+
+	//------------ argument parsing ------------
+
+	uint32_t bot_count = 16;
+	double ramp = 0.0; //seconds over which to add bots (0 = all at once)
+	double duration = 0.0; //seconds to run after all bots are added (0 = forever)
+	double move_rate = 30.0; //'i' messages per second per bot
+	double ping_rate = 4.0; //'p' messages per second per bot
+
+	auto usage = [&]() {
+		std::cerr << "Usage:\n\t./loadgen <host> <port> [--bots N] [--ramp SECONDS] [--duration SECONDS] [--move-rate HZ] [--ping-rate HZ]" << std::endl;
+		return 1;
+	};
+	if (argc < 3 || (argc - 3) % 2 != 0) return usage();
+	std::string host = argv[1];
+	std::string port = argv[2];
+	for (int i = 3; i + 1 < argc; i += 2) {
+		std::string arg = argv[i];
+		double value = std::stod(argv[i+1]);
+		if (arg == "--bots") bot_count = uint32_t(value);
+		else if (arg == "--ramp") ramp = value;
+		else if (arg == "--duration") duration = value;
+		else if (arg == "--move-rate") move_rate = value;
+		else if (arg == "--ping-rate") ping_rate = value;
+		else return usage();
+	}
+
+	//------------ main loop ------------
+
+	std::mt19937 mt(0x15466);
+	std::vector< std::unique_ptr< Bot > > bots;
+	uint32_t bots_added = 0;
+
+	Stats stats, total;
+	double start = steady_now();
+	double last_report = start;
+	uint32_t last_report_tick = 0;
+	bool last_report_had_tick = false;
+
+	while (true) {
+		double now = steady_now();
+
+		//add bots (spread over 'ramp' seconds):
+		while (bots_added < bot_count && (ramp <= 0.0 || now - start >= ramp * double(bots_added) / double(bot_count))) {
+			bots.emplace_back(std::make_unique< Bot >(host, port, mt));
+			bots_added += 1;
+		}
+
+		//run every bot:
+		for (auto b = bots.begin(); b != bots.end(); /*later*/) {
+			if ((*b)->update(now, start, move_rate, ping_rate, stats)) {
+				++b;
+			} else {
+				std::cout << "[loadgen] bot disconnected." << std::endl;
+				b = bots.erase(b);
+			}
+		}
+
+		//report once per second:
+		if (now - last_report >= 1.0) {
+			double elapsed = now - last_report;
+			double ticks = 0.0;
+			if (stats.any_tick && last_report_had_tick) ticks = double(stats.newest_tick - last_report_tick) / elapsed;
+			std::printf("[loadgen] %6.1fs bots %4d | in %8.1f kB/s out %7.1f kB/s | ticks/s %5.1f | interval %s | lag %s | rtt %s\n",
+				now - start, int(bots.size()),
+				stats.bytes_in / elapsed / 1024.0, stats.bytes_out / elapsed / 1024.0,
+				ticks,
+				stats.interval.summary_ms().c_str(), stats.lag.summary_ms().c_str(), stats.rtt.summary_ms().c_str());
+			std::fflush(stdout);
+
+			if (stats.any_tick) {
+				last_report_tick = stats.newest_tick;
+				last_report_had_tick = true;
+			}
+			if (bots_added == bot_count) {
+				total.interval.merge(stats.interval);
+				total.lag.merge(stats.lag);
+				total.rtt.merge(stats.rtt);
+			}
+			stats.clear();
+			last_report = now;
+		}
+
+		if (duration > 0.0 && bots_added == bot_count && now - start >= std::max(ramp, 0.0) + duration) break;
+
+		//(bots only need to act at their message rates, so don't spin)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	std::cout << "[loadgen] with " << bots.size() << " bots:\n"
+		<< "\tinterval " << total.interval.summary_ms() << "\n"
+		<< "\tlag      " << total.lag.summary_ms() << "\n"
+		<< "\trtt      " << total.rtt.summary_ms() << std::endl;
+
+	return 0;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
@@ -0,0 +1,305 @@
+//optimize-meshes reorders each mesh in a mesh file so the GPU does less work drawing it:
+// - triangles are put in an order that re-uses recently shaded vertices (Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"),
+// - vertices are put in the order those triangles first use them (so vertex fetches walk forward through memory),
+// - optionally (--overdraw), runs of those triangles are sorted so outward-facing parts of the mesh tend to draw first.
+// It reports each mesh's ACMR (cache misses per triangle; 3.0 is no re-use) and ATVR (cache misses per vertex; 1.0 is ideal) before and after.
+// (triangle soup files are welded first -- see weld-meshes.cpp -- since there is no re-use without indices)
+
+#include "MeshFile.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+//the post-transform cache assumed when measuring (a FIFO, like most hardware has had):
+static constexpr uint32_t MeasureCacheSize = 16;
+//the cache assumed by the Forsyth scores (an LRU; the paper finds 32 works well for whatever the real cache is):
+static constexpr uint32_t ScoreCacheSize = 32;
+
+struct CacheStats {
+	uint32_t misses = 0;
+	uint32_t triangles = 0;
+	uint32_t vertices = 0; //(that any triangle uses)
+	float acmr() const { return triangles ? float(misses) / float(triangles) : 0.0f; }
+	float atvr() const { return vertices ? float(misses) / float(vertices) : 0.0f; }
+};
+
+//run triangle corners through a FIFO cache of MeasureCacheSize vertices, also noting which triangles missed on every corner:
+static CacheStats measure(std::vector< uint32_t > const &corners, uint32_t vertex_count, std::vector< bool > *cold = nullptr) {
+	CacheStats stats;
+	stats.triangles = uint32_t(corners.size() / 3);
+	std::vector< uint32_t > entered(vertex_count, 0); //time (1-based) each vertex last entered the cache (0 = never)
+	std::vector< bool > used(vertex_count, false);
+	uint32_t time = 0;
+	if (cold) cold->assign(stats.triangles, false);
+	for (uint32_t t = 0; t < stats.triangles; ++t) {
+		uint32_t missed = 0;
+		for (uint32_t c = 0; c < 3; ++c) {
+			uint32_t v = corners[3 * t + c];
+			if (!used[v]) {
+				used[v] = true;
+				stats.vertices += 1;
+			}
+			if (entered[v] == 0 || time - entered[v] >= MeasureCacheSize) {
+				time += 1;
+				entered[v] = time;
+				missed += 1;
+			}
+		}
+		stats.misses += missed;
+		if (cold && missed == 3) (*cold)[t] = true;
+	}
+	return stats;
+}
+
+//reorder triangles for the post-transform cache (Forsyth 2006):
+static std::vector< uint32_t > order_for_cache(std::vector< uint32_t > const &corners, uint32_t vertex_count) {
+	uint32_t triangles = uint32_t(corners.size() / 3);
+
+	//triangles using each vertex (as ranges in one array):
+	std::vector< uint32_t > first_use(vertex_count + 1, 0);
+	for (uint32_t v : corners) first_use[v + 1] += 1;
+	for (uint32_t v = 0; v < vertex_count; ++v) first_use[v + 1] += first_use[v];
+	std::vector< uint32_t > uses(corners.size());
+	{
+		std::vector< uint32_t > at(first_use.begin(), first_use.end() - 1);
+		for (uint32_t i = 0; i < corners.size(); ++i) {
+			uses[at[corners[i]]++] = i / 3;
+		}
+	}
+	std::vector< uint32_t > remaining(vertex_count); //triangles using each vertex that aren't added yet
+	for (uint32_t v = 0; v < vertex_count; ++v) {
+		remaining[v] = first_use[v + 1] - first_use[v];
+	}
+
+	std::vector< int32_t > cache_position(vertex_count, -1);
+	auto vertex_score = [&](uint32_t v) {
+		if (remaining[v] == 0) return -1.0f; //(nothing left to draw with it)
+		float score = 0.0f;
+		int32_t p = cache_position[v];
+		if (p >= 0) {
+			if (p < 3) {
+				score = 0.75f; //(just used by the last triangle, so don't strongly prefer it -- that makes strips, not fans)
+			} else {
+				score = std::pow(1.0f - float(p - 3) / float(ScoreCacheSize - 3), 1.5f);
+			}
+		}
+		score += 2.0f / std::sqrt(float(remaining[v])); //(finish off vertices with few triangles left, so they don't get stranded)
+		return score;
+	};
+	std::vector< float > score(vertex_count);
+	for (uint32_t v = 0; v < vertex_count; ++v) score[v] = vertex_score(v);
+	std::vector< float > triangle_score(triangles);
+	for (uint32_t t = 0; t < triangles; ++t) {
+		triangle_score[t] = score[corners[3*t+0]] + score[corners[3*t+1]] + score[corners[3*t+2]];
+	}
+
+	std::vector< bool > added(triangles, false);
+	std::vector< uint32_t > cache; //most recent first (up to ScoreCacheSize + 3 entries while updating)
+	std::vector< uint32_t > out;
+	out.reserve(corners.size());
+	uint32_t next_unadded = 0; //(for finding somewhere to start when nothing in the cache has triangles left)
+	int32_t best = (triangles ? 0 : -1);
+	for (uint32_t t = 1; t < triangles; ++t) {
+		if (triangle_score[t] > triangle_score[best]) best = t;
+	}
+
+	while (best >= 0) {
+		//add the best triangle:
+		added[best] = true;
+		std::vector< uint32_t > new_cache;
+		for (uint32_t c = 0; c < 3; ++c) {
+			uint32_t v = corners[3 * best + c];
+			out.emplace_back(v);
+			if (std::find(new_cache.begin(), new_cache.end(), v) == new_cache.end()) new_cache.emplace_back(v);
+			//(remove it from the vertex's list of triangles)
+			uint32_t *begin = uses.data() + first_use[v];
+			uint32_t *end = begin + remaining[v];
+			std::iter_swap(std::find(begin, end, uint32_t(best)), end - 1);
+			remaining[v] -= 1;
+		}
+		uint32_t used = uint32_t(new_cache.size());
+		for (uint32_t v : cache) {
+			if (std::find(new_cache.begin(), new_cache.begin() + used, v) == new_cache.begin() + used) new_cache.emplace_back(v);
+		}
+		//vertices that fell out of the cache:
+		for (uint32_t i = ScoreCacheSize; i < new_cache.size(); ++i) {
+			cache_position[new_cache[i]] = -1;
+			score[new_cache[i]] = vertex_score(new_cache[i]);
+		}
+		if (new_cache.size() > ScoreCacheSize) new_cache.resize(ScoreCacheSize);
+		cache = std::move(new_cache);
+
+		//re-score the cache and look for the best triangle that uses any vertex in it:
+		for (uint32_t i = 0; i < cache.size(); ++i) {
+			cache_position[cache[i]] = int32_t(i);
+			score[cache[i]] = vertex_score(cache[i]);
+		}
+		best = -1;
+		float best_score = -1.0f;
+		for (uint32_t v : cache) {
+			for (uint32_t u = 0; u < remaining[v]; ++u) {
+				uint32_t t = uses[first_use[v] + u];
+				triangle_score[t] = score[corners[3*t+0]] + score[corners[3*t+1]] + score[corners[3*t+2]];
+				if (triangle_score[t] > best_score) {
+					best_score = triangle_score[t];
+					best = int32_t(t);
+				}
+			}
+		}
+
+		//nothing in the cache has triangles left, so start again from the first triangle not yet added:
+		if (best < 0) {
+			while (next_unadded < triangles && added[next_unadded]) ++next_unadded;
+			if (next_unadded < triangles) best = int32_t(next_unadded);
+		}
+	}
+
+	return out;
+}
+
+//sort runs of (already cache-ordered) triangles so the ones facing away from the mesh's center draw first:
+// (Sander, Nehab, and Barczak 2007's clustering, with runs split where the cache went cold anyway, so ACMR barely changes)
+static std::vector< uint32_t > order_for_overdraw(std::vector< uint32_t > const &corners, std::vector< MeshFile::Vertex > const &vertices) {
+	std::vector< bool > cold;
+	measure(corners, uint32_t(vertices.size()), &cold);
+	uint32_t triangles = uint32_t(corners.size() / 3);
+
+	struct Cluster {
+		uint32_t begin, end; //triangles
+		float sort_key = 0.0f;
+	};
+	std::vector< Cluster > clusters;
+	for (uint32_t t = 0; t < triangles; ++t) {
+		if (t == 0 || cold[t]) clusters.emplace_back(Cluster{ t, t });
+		clusters.back().end = t + 1;
+	}
+
+	//area-weighted center of the whole mesh:
+	auto position = [&](uint32_t t, uint32_t c) { return vertices[corners[3 * t + c]].Position; };
+	glm::vec3 mesh_center = glm::vec3(0.0f);
+	float mesh_area = 0.0f;
+	for (uint32_t t = 0; t < triangles; ++t) {
+		float area = glm::length(glm::cross(position(t, 1) - position(t, 0), position(t, 2) - position(t, 0)));
+		mesh_center += area * (position(t, 0) + position(t, 1) + position(t, 2)) / 3.0f;
+		mesh_area += area;
+	}
+	if (mesh_area > 0.0f) mesh_center /= mesh_area;
+
+	//clusters facing further out (from the center) go first, since they are the most likely to cover other parts of the mesh:
+	for (auto &cluster : clusters) {
+		glm::vec3 center = glm::vec3(0.0f);
+		glm::vec3 normal = glm::vec3(0.0f); //(area-weighted)
+		float area = 0.0f;
+		for (uint32_t t = cluster.begin; t < cluster.end; ++t) {
+			glm::vec3 n = glm::cross(position(t, 1) - position(t, 0), position(t, 2) - position(t, 0));
+			float a = glm::length(n);
+			center += a * (position(t, 0) + position(t, 1) + position(t, 2)) / 3.0f;
+			normal += n;
+			area += a;
+		}
+		if (area > 0.0f) center /= area;
+		float normal_length = glm::length(normal);
+		if (normal_length > 0.0f) cluster.sort_key = glm::dot(center - mesh_center, normal / normal_length);
+	}
+	std::stable_sort(clusters.begin(), clusters.end(), [](Cluster const &a, Cluster const &b) {
+		return a.sort_key > b.sort_key;
+	});
+
+	std::vector< uint32_t > out;
+	out.reserve(corners.size());
+	for (auto const &cluster : clusters) {
+		out.insert(out.end(), corners.begin() + 3 * cluster.begin, corners.begin() + 3 * cluster.end);
+	}
+	return out;
+}
+
+int main(int argc, char **argv) {
+	std::vector< std::string > args(argv + 1, argv + argc);
+	bool overdraw = false;
+	if (!args.empty() && args[0] == "--overdraw") {
+		overdraw = true;
+		args.erase(args.begin());
+	}
+	if (args.size() != 2) {
+		std::cerr << "Usage:\n\t" << argv[0] << " [--overdraw] <in.pnct> <out.pnct>\n(in and out may be the same file)" << std::endl;
+		return 1;
+	}
+
+	try {
+		MeshFile file(args[0]);
+		if (!file.indexed) {
+			file.weld();
+			std::cout << "(welded '" << args[0] << "' first; 'before' numbers are for the welded meshes)" << std::endl;
+		}
+
+		CacheStats total_before, total_after;
+		auto add = [](CacheStats &total, CacheStats const &stats) {
+			total.misses += stats.misses;
+			total.triangles += stats.triangles;
+			total.vertices += stats.vertices;
+		};
+
+		std::cout << std::fixed << std::setprecision(3);
+		std::cout << "ACMR / ATVR with a " << MeasureCacheSize << "-vertex FIFO cache:" << std::endl;
+
+		std::vector< MeshFile::Vertex > new_vertices;
+		std::vector< uint32_t > new_indices;
+		for (auto &mesh : file.meshes) {
+			std::vector< MeshFile::Vertex > vertices(file.vertices.begin() + mesh.vertex_begin, file.vertices.begin() + mesh.vertex_end);
+			std::vector< uint32_t > corners = file.corners(mesh);
+			if (corners.size() % 3 != 0) {
+				throw std::runtime_error("mesh '" + mesh.name + "' has a partial triangle");
+			}
+
+			CacheStats before = measure(corners, uint32_t(vertices.size()));
+
+			corners = order_for_cache(corners, uint32_t(vertices.size()));
+			if (overdraw) corners = order_for_overdraw(corners, vertices);
+
+			//vertices in the order the triangles first use them (dropping any unused ones):
+			std::vector< uint32_t > remap(vertices.size(), -1U);
+			uint32_t vertex_begin = uint32_t(new_vertices.size());
+			for (uint32_t &c : corners) {
+				if (remap[c] == -1U) {
+					remap[c] = uint32_t(new_vertices.size()) - vertex_begin;
+					new_vertices.emplace_back(vertices[c]);
+				}
+				c = remap[c];
+			}
+
+			CacheStats after = measure(corners, uint32_t(new_vertices.size()) - vertex_begin);
+
+			mesh.vertex_begin = vertex_begin;
+			mesh.vertex_end = uint32_t(new_vertices.size());
+			mesh.index_begin = uint32_t(new_indices.size());
+			new_indices.insert(new_indices.end(), corners.begin(), corners.end());
+			mesh.index_end = uint32_t(new_indices.size());
+
+			std::cout << "  '" << mesh.name << "': " << after.triangles << " triangles, " << after.vertices << " vertices; "
+			          << "ACMR " << before.acmr() << " -> " << after.acmr() << ", "
+			          << "ATVR " << before.atvr() << " -> " << after.atvr() << std::endl;
+			add(total_before, before);
+			add(total_after, after);
+		}
+		file.vertices = std::move(new_vertices);
+		file.indices = std::move(new_indices);
+
+		file.save(args[1]);
+
+		std::cout << "All " << file.meshes.size() << " meshes: "
+		          << "ACMR " << total_before.acmr() << " -> " << total_after.acmr() << ", "
+		          << "ATVR " << total_before.atvr() << " -> " << total_after.atvr() << std::endl;
+	} catch (std::exception &e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
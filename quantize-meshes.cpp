@@ -0,0 +1,54 @@
+//quantize-meshes rewrites a mesh file with its vertices quantized (see MeshFile::QuantizedVertex):
+// positions as 16-bit fractions of each mesh's bounding box, normals as 10:10:10 signed normalized, and texture coordinates as half floats.
+// That's 20 bytes per vertex instead of 36; it reports how far the quantized vertices ended up from the originals.
+
+#include "MeshFile.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <in.pnct> <out.pnct>\n(in and out may be the same file)" << std::endl;
+		return 1;
+	}
+
+	try {
+		MeshFile file(argv[1]);
+		if (file.quantized) {
+			std::cout << "NOTE: '" << argv[1] << "' is already quantized; quantizing again may lose a bit more precision." << std::endl;
+		}
+
+		file.quantized = true;
+		file.save(argv[2]);
+
+		//read it back to see what the quantization did:
+		MeshFile quantized(argv[2]);
+		if (quantized.vertices.size() != file.vertices.size()) {
+			throw std::runtime_error("Quantized file has a different number of vertices.");
+		}
+		float position_error = 0.0f; //(largest distance, in mesh units)
+		float normal_error = 0.0f; //(largest angle, in degrees)
+		float tex_coord_error = 0.0f; //(largest distance, in texture units)
+		for (uint32_t v = 0; v < file.vertices.size(); ++v) {
+			MeshFile::Vertex const &a = file.vertices[v];
+			MeshFile::Vertex const &b = quantized.vertices[v];
+			position_error = std::max(position_error, glm::length(a.Position - b.Position));
+			if (glm::length(a.Normal) > 0.0f) {
+				float cos_angle = glm::dot(glm::normalize(a.Normal), glm::normalize(b.Normal));
+				normal_error = std::max(normal_error, glm::degrees(std::acos(glm::clamp(cos_angle, -1.0f, 1.0f))));
+			}
+			tex_coord_error = std::max(tex_coord_error, glm::length(a.TexCoord - b.TexCoord));
+		}
+
+		std::cout << "Quantized " << file.vertices.size() << " vertices in " << file.meshes.size() << " meshes from '" << argv[1] << "': "
+		          << file.vertices.size() * sizeof(MeshFile::Vertex) << " -> " << file.vertices.size() * sizeof(MeshFile::QuantizedVertex) << " bytes; "
+		          << "largest errors: position " << position_error << ", normal " << normal_error << " degrees, texcoord " << tex_coord_error << "." << std::endl;
+	} catch (std::exception &e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+/*
+ * Allocation-free helpers for packing transforms into network messages.
+ *
+ * Positions are stored as 16-bit fixed point per axis over the (padded) arena
+ *  bounds; rotations use the "smallest three" packing of a unit quaternion
+ *  into 32 bits. Everything is written big-endian so that clients and server
+ *  agree regardless of platform.
+ *
+ * Used by both server.cpp and PlayMode.cpp:
+
+	uint8_t bytes[TransformBytes];
+	encode_transform(position, rotation, bytes);
+	connection.send_raw(bytes, TransformBytes);
+
+ */
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+
+//Quantization bounds for positions.
+// the playable city is x in [-7,19], y in [-15,21] at z = 0.6 (see Movement.hpp),
+// with room to spare around it:
+constexpr float PositionMin[3] = {  -8.0f, -16.0f, -12.0f };
+constexpr float PositionMax[3] = {  20.0f,  22.0f,   4.0f };
+
+//map [min,max] to [0,65535] (clamping out-of-range values and mapping NaN to min):
+constexpr uint16_t quantize_unorm16(float value, float min, float max) {
+	float t = (value - min) / (max - min);
+	if (!(t > 0.0f)) return 0;
+	if (t >= 1.0f) return 0xffff;
+	return uint16_t(t * 65535.0f + 0.5f);
+}
+constexpr float dequantize_unorm16(uint16_t value, float min, float max) {
+	return min + (max - min) * (float(value) / 65535.0f);
+}
+
+//position <-> three 16-bit values:
+inline glm::u16vec3 quantize_position(glm::vec3 const &position) {
+	return glm::u16vec3(
+		quantize_unorm16(position.x, PositionMin[0], PositionMax[0]),
+		quantize_unorm16(position.y, PositionMin[1], PositionMax[1]),
+		quantize_unorm16(position.z, PositionMin[2], PositionMax[2])
+	);
+}
+inline glm::vec3 dequantize_position(glm::u16vec3 const &position) {
+	return glm::vec3(
+		dequantize_unorm16(position.x, PositionMin[0], PositionMax[0]),
+		dequantize_unorm16(position.y, PositionMin[1], PositionMax[1]),
+		dequantize_unorm16(position.z, PositionMin[2], PositionMax[2])
+	);
+}
+
+//rotation <-> 32 bits, as the index of the largest-magnitude component (2 bits)
+// followed by the other three components (10 bits each) -- the largest
+// component is recovered from the unit length constraint:
+constexpr float SmallestThreeRange = 0.70710678f; //the non-largest components are within +/- 1/sqrt(2)
+
+inline uint32_t pack_rotation(glm::quat const &rotation) {
+	float q[4] = { rotation.x, rotation.y, rotation.z, rotation.w };
+	uint32_t largest = 0;
+	for (uint32_t i = 1; i < 4; ++i) {
+		if (std::abs(q[i]) > std::abs(q[largest])) largest = i;
+	}
+	//q and -q are the same rotation, so flip so the dropped component is positive:
+	float sign = (q[largest] < 0.0f ? -1.0f : 1.0f);
+
+	uint32_t packed = largest;
+	for (uint32_t i = 0; i < 4; ++i) {
+		if (i == largest) continue;
+		uint32_t bits = quantize_unorm16(sign * q[i], -SmallestThreeRange, SmallestThreeRange) >> 6;
+		packed = (packed << 10) | bits;
+	}
+	return packed;
+}
+
+inline glm::quat unpack_rotation(uint32_t packed) {
+	uint32_t largest = packed >> 30;
+	float q[4];
+	float sum2 = 0.0f;
+	for (uint32_t i = 3; i < 4; --i) {
+		if (i == largest) continue;
+		uint32_t bits = packed & 0x3ff;
+		packed >>= 10;
+		//(expand 10 bits back to 16 so the dequantization matches quantize_unorm16)
+		q[i] = dequantize_unorm16(uint16_t((bits << 6) | (bits >> 4)), -SmallestThreeRange, SmallestThreeRange);
+		sum2 += q[i] * q[i];
+	}
+	q[largest] = std::sqrt(std::max(0.0f, 1.0f - sum2));
+	return glm::normalize(glm::quat(q[3], q[0], q[1], q[2])); //n.b. wxyz init order
+}
+
+//big-endian byte helpers:
+inline void put_uint16(uint16_t value, uint8_t *to) {
+	to[0] = uint8_t(value >> 8);
+	to[1] = uint8_t(value);
+}
+inline uint16_t get_uint16(uint8_t const *from) {
+	return uint16_t((uint16_t(from[0]) << 8) | uint16_t(from[1]));
+}
+inline void put_uint32(uint32_t value, uint8_t *to) {
+	to[0] = uint8_t(value >> 24);
+	to[1] = uint8_t(value >> 16);
+	to[2] = uint8_t(value >> 8);
+	to[3] = uint8_t(value);
+}
+inline uint32_t get_uint32(uint8_t const *from) {
+	return (uint32_t(from[0]) << 24) | (uint32_t(from[1]) << 16) | (uint32_t(from[2]) << 8) | uint32_t(from[3]);
+}
+
+//a transform on the wire is a quantized position (3 x 2 bytes) followed by a packed rotation (4 bytes):
+constexpr size_t TransformBytes = 3 * 2 + 4;
+
+inline void encode_transform(glm::vec3 const &position, glm::quat const &rotation, uint8_t *to) {
+	glm::u16vec3 q = quantize_position(position);
+	put_uint16(q.x, to + 0);
+	put_uint16(q.y, to + 2);
+	put_uint16(q.z, to + 4);
+	put_uint32(pack_rotation(rotation), to + 6);
+}
+
+inline void decode_transform(uint8_t const *from, glm::vec3 *position, glm::quat *rotation) {
+	if (position) {
+		*position = dequantize_position(glm::u16vec3(get_uint16(from + 0), get_uint16(from + 2), get_uint16(from + 4)));
+	}
+	if (rotation) {
+		*rotation = unpack_rotation(get_uint32(from + 6));
+	}
+}
@@ -5,6 +5,8 @@
 #include <stdexcept>
 #include <cassert>
 
+//(to look at the chunks of a whole file without reading/copying them, see MappedChunks.hpp)
+
 //helper function that reads an array of structures preceded by a simple header:
 //Expected format:
 // |ma|gi|c.|..| <-- four byte "magic number"
@@ -1,24 +1,74 @@
 
 #include "Connection.hpp"
+#include "ShardedServer.hpp"
+#include "UDPConnection.hpp"
 
+#include "data_path.hpp"
 #include "hex_dump.hpp"
+#include "Movement.hpp"
+#include "quantize.hpp"
+#include "Scene.hpp"
+#include "Snapshot.hpp"
+#include "SpatialGrid.hpp"
+#include "TickProfiler.hpp"
 
 #include <chrono>
 #include <stdexcept>
 #include <iostream>
+#include <fstream>
+#include <cstring>
 #include <cassert>
 #include <unordered_map>
+#include <memory>
+#include <random>
+#include <functional>
 
 #include <glm/glm.hpp>
 
+//reliable UDP channel for 'm' messages:
+constexpr uint8_t TextChannel = 1;
+
+//the interest grid covers the city (see Movement.hpp) in cells this big:
+constexpr float InterestCellSize = 4.0f;
+
+//players between the near and far interest radii are only updated every FarInterval ticks:
+constexpr uint32_t FarInterval = 4;
+
 int num_connected = 0;
 int it_player = 1;
 
-uint8_t absolute_float_to_uint8_t(float f) {
-	f = std::abs(f);
-	int tens = (int)f % 10;
-	int ones = (int)f - (tens * 10);
-	return tens * 10 + ones;
+//tagging rules: "it" can't tag anyone for ItFreeze seconds (see Movement.hpp), then tags players within TagDistance (in xy):
+constexpr float TagDistance = 0.25f;
+
+//build an 'm' message (3-byte length + text) that can be queued on any number of connections:
+static Connection::SharedData make_text_message(std::string const &text) {
+	auto message = std::make_shared< std::vector< char > >();
+	message->reserve(4 + text.size());
+	message->emplace_back('m');
+	message->emplace_back(char(text.size() >> 16));
+	message->emplace_back(char((text.size() >> 8) % 256));
+	message->emplace_back(char(text.size() % 256));
+	message->insert(message->end(), text.begin(), text.end());
+	return message;
+}
+
+//size of the whole client message at the front of 'buffer':
+// (0 if it hasn't all arrived yet; ShardedServer::InvalidMessage if it isn't a message clients send)
+// note: called from I/O threads, so must not touch game state
+static size_t client_message_size(RingBuffer const &buffer) {
+	if (buffer.size() < 1) return 0;
+	//expecting 'i' + (inputs, see Movement.hpp), 'a' + (acknowledged snapshot tick), or 'p' + (ping stamp)
+	char type = buffer[0];
+	size_t size = 0;
+	if (type == 'i') {
+		if (buffer.size() < 1 + 4 + 1) return 0;
+		uint32_t count = uint8_t(buffer[5]);
+		if (count == 0 || count > MaxInputsPerMessage) return ShardedServer::InvalidMessage;
+		size = input_message_size(count);
+	}
+	else if (type == 'a' || type == 'p') size = 1 + 4;
+	else return ShardedServer::InvalidMessage;
+	return (buffer.size() < size ? 0 : size);
 }
 
 int main(int argc, char **argv) {
@@ -29,20 +79,64 @@ int main(int argc, char **argv) {
 
 	//------------ argument parsing ------------
 
-	if (argc != 2) {
-		std::cerr << "Usage:\n\t./server <port>" << std::endl;
+	double stats_interval = 10.0; //seconds between tick profiler reports (0 = never)
+	std::string stats_file = ""; //append reports here instead of printing them
+	uint32_t threads = 0; //I/O threads for TCP connections (0 = do I/O on the main thread)
+	float near_radius = 10.0f; //clients hear about players this close every tick
+	float far_radius = 30.0f; //...players this close every FarInterval ticks, and nothing about players farther away
+
+	auto usage = [&]() {
+		std::cerr << "Usage:\n\t./server <port> [--threads N] [--near-radius UNITS] [--far-radius UNITS] [--stats-interval SECONDS] [--stats-file PATH]" << std::endl;
 		return 1;
+	};
+	if (argc < 2 || (argc - 2) % 2 != 0) return usage();
+	for (int i = 2; i + 1 < argc; i += 2) {
+		std::string arg = argv[i];
+		if (arg == "--threads") threads = uint32_t(std::stoul(argv[i+1]));
+		else if (arg == "--near-radius") near_radius = std::stof(argv[i+1]);
+		else if (arg == "--far-radius") far_radius = std::stof(argv[i+1]);
+		else if (arg == "--stats-interval") stats_interval = std::stod(argv[i+1]);
+		else if (arg == "--stats-file") stats_file = argv[i+1];
+		else return usage();
 	}
 
 	//------------ initialization ------------
 
-	Server server(argv[1]);
+	//the city, for the buildings players can't walk into and where players start:
+	Obstacles obstacles;
+	struct Spawn {
+		glm::vec3 position;
+		glm::quat rotation;
+	};
+	std::vector< Spawn > spawns;
+	{
+		Scene city(data_path("game2-city.scene"), nullptr);
+		obstacles = find_obstacles(city);
+		for (auto const &camera : city.cameras) {
+			spawns.emplace_back(Spawn{ camera.transform->position(), camera.transform->rotation() });
+		}
+		if (spawns.empty()) throw std::runtime_error("Expecting the city scene to have cameras to start players at.");
+	}
+
+	ShardedServer server(argv[1], threads, client_message_size);
+	UDPServer udp_server(argv[1]); //(same port number, but UDP)
 
+	TickProfiler profiler;
+	std::ofstream stats_out;
+	if (stats_file != "") {
+		stats_out.open(stats_file, std::ios::app);
+		if (!stats_out) throw std::runtime_error("Failed to open stats file '" + stats_file + "'.");
+	}
 
 	//------------ main loop ------------
-	constexpr float ServerTick = 1.0f / 60.0f; //60fps is almost certainly over-kill, but idk, I like it lol
 
 	//server state:
+	uint32_t tick = 0; //tick of the next snapshot
+	std::vector< Snapshot > history(SnapshotHistory); //recent snapshots of every player, indexed by tick % SnapshotHistory
+	std::vector< uint32_t > world_index; //where each player (by id) is in this tick's snapshot
+
+	//where every player is (kept up to date as they move), for finding who is near whom:
+	SpatialGrid grid(CityMin, CityMax, InterestCellSize);
 
 	//per-client state:
 	struct PlayerInfo {
@@ -53,188 +147,448 @@ int main(int argc, char **argv) {
 			next_player_id += 1;
 
 			position = glm::vec3(0.0f, 0.0f, -10.0f);
-			//euler_angles = glm::vec3(45.0f, 0.0f, 0.0f);
 		}
 
 		int id;
 		std::string name;
 		glm::vec3 position;
-		glm::vec3 euler_angles;
+		glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+
+		uint32_t last_input = 0; //sequence number of the last input applied (0 = none yet)
+		uint32_t reported_input = 0; //last_input as of the last 'r' message sent to the client
+
+		uint32_t udp_token = 0; //sent to the client over TCP so it can link its UDP connection
+		UDPConnection *udp = nullptr; //linked UDP connection, if any
+
+		uint32_t acked_tick = NoBaseline; //most recent snapshot the client has acknowledged
+		//snapshots as sent to this client (only the players it is interested in), for use as delta baselines, indexed by tick % SnapshotHistory:
+		// (a view of every player, all up to date, is marked 'whole' and left empty, since it is the same as that tick's history entry)
+		std::vector< Snapshot > views = std::vector< Snapshot >(SnapshotHistory);
+		std::vector< bool > whole_views = std::vector< bool >(SnapshotHistory, false);
+		Connection::SharedData snapshot_message; //this tick's view, encoded
+		int it_player_sent = -1; //it_player as of the last "who is it" message sent to this client
+	};
+	std::unordered_map< ShardedServer::ConnectionId, PlayerInfo > players;
+	std::unordered_map< uint32_t, PlayerInfo * > players_by_id; //(same players, by PlayerInfo::id)
+
+	uint32_t it_since_tick = 0; //when it_player became it (or connected)
+
+	//how fast a player moves right now (matching the client's prediction):
+	auto player_speed = [&](PlayerInfo const &player) -> float {
+		if (player.id != it_player) return PlayerSpeed;
+		if ((tick - it_since_tick) * ServerTick < ItFreeze) return 0.0f;
+		return PlayerSpeed * ItSpeedup;
+	};
+
+	//players whose UDP connection has been linked (by sending back the token their TCP connection was given):
+	std::unordered_map< UDPConnection *, PlayerInfo * > udp_players;
+	std::mt19937 token_generator(std::random_device{}());
+
+	//handle one whole message (as framed by client_message_size) from a player's client (over either connection):
+	// 'reply' sends a message back the same way
+	auto handle_message = [&](char const *message, size_t size, PlayerInfo &player, std::function< void(void const *, size_t) > const &reply) {
+		char type = message[0];
+
+		if (type == 'i') {
+			//move the player by each input it hasn't had yet, in order (inputs lost on the way are skipped):
+			uint8_t const *data = reinterpret_cast< uint8_t const * >(message);
+			uint32_t first = get_uint32(data + 1);
+			uint32_t count = data[5];
+			float speed = player_speed(player);
+			for (uint32_t i = 0; i < count; ++i) {
+				uint32_t seq = first + i;
+				if (seq <= player.last_input) continue;
+				MoveInput input;
+				input.buttons = data[6 + i * 5];
+				input.rotation = get_uint32(data + 6 + i * 5 + 1);
+				player.position = move_player(player.position, input, speed, obstacles);
+				player.rotation = unpack_rotation(input.rotation);
+				player.last_input = seq;
+			}
+			grid.move(player.id, glm::vec2(player.position));
+		}
+
+		if (type == 'a') {
+			//remember the newest snapshot the client has (ignoring acks for snapshots that were never sent):
+			uint32_t acked = get_uint32(reinterpret_cast< uint8_t const * >(message + 1));
+			if (acked < tick && (player.acked_tick == NoBaseline || acked > player.acked_tick)) {
+				player.acked_tick = acked;
+			}
+		}
+
+		if (type == 'p') {
+			//answer right away with 'P' + the same stamp (used by loadgen to measure round-trip time):
+			char pong[1 + 4];
+			std::memcpy(pong, message, 1 + 4);
+			pong[0] = 'P';
+			reply(pong, 1 + 4);
+		}
 	};
-	std::unordered_map< Connection *, PlayerInfo > players;
+
+	//UDP connections are opened by clients, then linked to players by the token they got over TCP:
+	auto on_udp_event = [&](UDPConnection *u, UDPConnection::Event evt) {
+		TickProfiler::Scope scope(profiler, TickProfiler::Receive);
+		if (evt == UDPConnection::OnOpen) {
+			//(nothing to do until it sends a token)
+		} else if (evt == UDPConnection::OnClose) {
+			//player goes back to using TCP for everything:
+			auto f = udp_players.find(u);
+			if (f != udp_players.end()) {
+				f->second->udp = nullptr;
+				udp_players.erase(f);
+			}
+		} else { assert(evt == UDPConnection::OnRecv);
+			auto f = udp_players.find(u);
+			if (f == udp_players.end()) {
+				//expecting 'u' + (token) as the first message:
+				if (u->recv_buffer.size() < 1 + 4) return;
+				uint8_t message[1 + 4];
+				u->recv_buffer.peek(0, message, 1 + 4);
+				u->recv_buffer.consume(1 + 4);
+				uint32_t token = get_uint32(message + 1);
+				PlayerInfo *linked = nullptr;
+				for (auto &[c, player] : players) {
+					(void)c; //work around "unused variable" warning on whatever version of g++ github actions is running
+					if (message[0] == 'u' && player.udp == nullptr && player.udp_token == token) linked = &player;
+				}
+				if (!linked) {
+					std::cout << " UDP connection didn't start with a valid link token!" << std::endl;
+					u->close();
+					return;
+				}
+				linked->udp = u;
+				f = udp_players.emplace(u, linked).first;
+			}
+			auto reply = [u](void const *data, size_t size) {
+				u->send_unreliable(data, size);
+			};
+			while (true) {
+				size_t size = client_message_size(u->recv_buffer);
+				if (size == 0) break;
+				if (size == ShardedServer::InvalidMessage) {
+					std::cout << " message of non-'i', 'a', or 'p' type received from client!" << std::endl;
+					f->second->udp = nullptr;
+					udp_players.erase(f);
+					u->close();
+					return;
+				}
+				char message[ShardedServer::MaxMessage];
+				u->recv_buffer.peek(0, message, size);
+				u->recv_buffer.consume(size);
+				handle_message(message, size, *f->second, reply);
+			}
+		}
+	};
+
+	//TCP connections are the players:
+	// (messages arrive whole, already framed by client_message_size -- possibly on an I/O thread)
+	auto on_tcp_event = [&](ShardedServer::ConnectionId id, Connection::Event evt, char const *message, size_t size) {
+		TickProfiler::Scope scope(profiler, TickProfiler::Receive);
+		if (evt == Connection::OnOpen) {
+			//client connected:
+			num_connected++;
+
+			//create some player info for them:
+			players.emplace(id, PlayerInfo());
+			PlayerInfo &player = players.at(id);
+			//(players start where the scene's cameras are, as the client expects)
+			Spawn const &spawn = spawns[(player.id - 1) % spawns.size()];
+			player.position = spawn.position;
+			player.rotation = spawn.rotation;
+			players_by_id.emplace(player.id, &player);
+			grid.insert(player.id, glm::vec2(player.position));
+			if (player.id == it_player) it_since_tick = tick; //("it" starts frozen, just as the client does)
+
+			//find out which player the client is:
+			std::string connection_message = "Client is player ";
+			connection_message.append(std::to_string(num_connected));
+			std::cout << connection_message << std::endl;
+
+			//let the client know which player it is:
+			server.send_shared(id, make_text_message(connection_message));
+
+			//give the client a token to link its UDP connection with:
+			player.udp_token = token_generator();
+			uint8_t token_message[1 + 4];
+			token_message[0] = 'u';
+			put_uint32(player.udp_token, token_message + 1);
+			server.send_raw(id, token_message, 1 + 4);
+		} else if (evt == Connection::OnClose) {
+			//client disconnected:
+			//num_connected--;
+
+			//remove them from the players list:
+			auto f = players.find(id);
+			assert(f != players.end());
+			if (f->second.udp) {
+				udp_players.erase(f->second.udp);
+				f->second.udp->close();
+			}
+			grid.remove(f->second.id);
+			players_by_id.erase(f->second.id);
+			players.erase(f);
+
+
+		} else { assert(evt == Connection::OnRecv);
+			//got a message from client:
+
+			//look up in players list:
+			auto f = players.find(id);
+			assert(f != players.end());
+			PlayerInfo &player = f->second;
+
+			//handle message from client:
+			auto reply = [&server, id](void const *data, size_t size) {
+				server.send_raw(id, data, size);
+			};
+			handle_message(message, size, player, reply);
+		}
+	};
+
+	auto last_report = std::chrono::steady_clock::now();
 
 	while (true) {
 		static auto next_tick = std::chrono::steady_clock::now() + std::chrono::duration< double >(ServerTick);
+		auto tick_deadline = next_tick; //when the tick now starting was due
 		//process incoming data from clients until a tick has elapsed:
 		while (true) {
+			//(UDP is polled without waiting: after the last tick's sends were queued, and again before each tick)
+			udp_server.poll(on_udp_event, 0.0);
+
 			auto now = std::chrono::steady_clock::now();
 			double remain = std::chrono::duration< double >(next_tick - now).count();
 			if (remain < 0.0) {
+				tick_deadline = next_tick;
 				next_tick += std::chrono::duration< double >(ServerTick);
 				break;
 			}
-			server.poll([&](Connection *c, Connection::Event evt){
-				if (evt == Connection::OnOpen) {
-					//client connected:
-					num_connected++;
-
-					//create some player info for them:
-					players.emplace(c, PlayerInfo());
-
-					//find out which player the client is:
-					std::string connection_message = "Client is player ";
-					connection_message.append(std::to_string(num_connected));
-					std::cout << connection_message << std::endl;
-
-					//let the client know which player it is:
-					c->send('m');
-					c->send(uint8_t(connection_message.size() >> 16));
-					c->send(uint8_t((connection_message.size() >> 8) % 256));
-					c->send(uint8_t(connection_message.size() % 256));
-					c->send_buffer.insert(c->send_buffer.end(), connection_message.begin(), connection_message.end());
-				} else if (evt == Connection::OnClose) {
-					//client disconnected:
-					//num_connected--;
-
-					//remove them from the players list:
-					auto f = players.find(c);
-					assert(f != players.end());
-					players.erase(f);
-
-
-				} else { assert(evt == Connection::OnRecv);
-					//got data from client:
-					//std::cout << "got bytes:\n" << hex_dump(c->recv_buffer); std::cout.flush();
-
-					//look up in players list:
-					auto f = players.find(c);
-					assert(f != players.end());
-					PlayerInfo &player = f->second;
-
-					//handle messages from client:
-					while (c->recv_buffer.size() >= 10) {
-						//expecting 'f' + seven float messages 'f' (x_pos) (y_pos) (z_pos) (x_rot) (y_rot) (z_rot)
-						char type = c->recv_buffer[0];
-						if (type != 'b' && type != 't') {
-							std::cout << " message of non-'b' or 't' type received from client!" << std::endl;
-							//shut down client connection:
-							c->close();
-							return;
-						}
-
-						if (type == 'b') {
-							//for getting a float out of a string: https://www.programiz.com/cpp-programming/string-float-conversion
-							//construct position floats
-							float client_x = std::stof(std::to_string(c->recv_buffer[2]));
-							client_x += (std::stof(std::to_string(c->recv_buffer[3])) / 100.0f);
-							if (c->recv_buffer[1] == (uint8_t)1) client_x *= -1.0f;
-							float client_y = std::stof(std::to_string(c->recv_buffer[5]));
-							client_y += (std::stof(std::to_string(c->recv_buffer[6])) / 100.0f);
-							if (c->recv_buffer[4] == (uint8_t)1) client_y *= -1.0f;
-							float client_z = std::stof(std::to_string(c->recv_buffer[8]));
-							client_z += (std::stof(std::to_string(c->recv_buffer[9])) / 100.0f);
-							if (c->recv_buffer[7] == (uint8_t)1) client_z *= -1.0f;
-
-							//set the position of this player:
-							player.position = glm::vec3(client_x, client_y, client_z);
-
-							//consume this part of the buffer:
-							c->recv_buffer.erase(c->recv_buffer.begin(), c->recv_buffer.begin() + 10);
-						}
-						
-						if (type == 't') {
-							//set the player that is now it:
-							it_player = (int)(c->recv_buffer[1]) + 1;
-
-							//consume this part of the buffer:
-							c->recv_buffer.erase(c->recv_buffer.begin(), c->recv_buffer.begin() + 2);
-						}
+			server.poll(on_tcp_event, remain);
+		}
+
+		double tick_late = std::chrono::duration< double >(std::chrono::steady_clock::now() - tick_deadline).count();
+
+		//------ simulate: gather this tick's state ------
+
+		//snapshot of every player:
+		Snapshot &world = history[tick % SnapshotHistory];
+		{
+			TickProfiler::Scope scope(profiler, TickProfiler::Simulate);
+
+			//tagging is decided here, once per tick, so there is exactly one (deterministic) outcome:
+			auto tagger = players_by_id.find(it_player);
+			if (tagger != players_by_id.end() && (tick - it_since_tick) * ServerTick >= ItFreeze) {
+				//"it" tags the nearest player in range (broadphase via the grid; ties go to the lowest id):
+				glm::vec2 at = glm::vec2(tagger->second->position);
+				uint32_t tagged = 0;
+				float tagged_distance2 = TagDistance * TagDistance;
+				grid.query(at, TagDistance, [&](uint32_t other, glm::vec2 const &, float distance2){
+					if (other == uint32_t(it_player)) return;
+					if (tagged == 0 || distance2 < tagged_distance2 || (distance2 == tagged_distance2 && other < tagged)) {
+						tagged = other;
+						tagged_distance2 = distance2;
 					}
+				});
+				if (tagged != 0) {
+					std::cout << players_by_id.at(it_player)->name << " tagged " << players_by_id.at(tagged)->name << "." << std::endl;
+					it_player = int(tagged);
+					it_since_tick = tick;
 				}
-			}, remain);
-		}
+			}
+
+			world.tick = tick;
+			world.entries.clear();
+			for (auto const &[id, player] : players) {
+				(void)id; //work around "unused variable" warning on whatever version of g++ github actions is running
+				Snapshot::Entry entry;
+				entry.id = uint16_t(player.id);
+				entry.position = quantize_position(player.position);
+				entry.rotation = pack_rotation(player.rotation);
+				world.entries.emplace_back(entry);
+			}
+			world.sort();
 
-		//update current game state
-		glm::vec3 positions[4] = { };
-		for (auto &[c, player] : players) {
-			(void)c; //work around "unused variable" warning on whatever version of g++ github actions is running
-			positions[player.id] = player.position;
+			world_index.assign(world.entries.empty() ? 0 : world.entries.back().id + 1, uint32_t(-1));
+			for (uint32_t i = 0; i < world.entries.size(); ++i) {
+				world_index[world.entries[i].id] = i;
+			}
 		}
 
-		//send updated game state to all clients
-		for (auto &[c, player_unused] : players) {
-			//(void)player_unused; //work around "unused variable" warning on whatever version of g++ github actions is running
-			for (auto &[c_unused, player] : players) {
-				(void)c_unused; //work around "unused variable" warning on whatever version of g++ github actions is running
-				
-				//send an update starting with 'f', then 24 floats representing the camera transforms:
-				c->send('t');
-
-				//get the sign for each axis of the player position:
-				uint8_t x_pos_sign = 0;
-				if (player.position.x < 0.0f) x_pos_sign = 1;
-				uint8_t y_pos_sign = 0;
-				if (player.position.y < 0.0f) y_pos_sign = 1;
-				uint8_t z_pos_sign = 0;
-				if (player.position.z < 0.0f) z_pos_sign = 1;
-
-				//get the digits to the left of the deimcal point:
-				uint8_t x_pos = absolute_float_to_uint8_t(player.position.x);
-				uint8_t y_pos = absolute_float_to_uint8_t(player.position.y);
-				uint8_t z_pos = absolute_float_to_uint8_t(player.position.z);
-
-				//get the first two digits to the right of the decimal point:
-				uint8_t x_pos_decimal = absolute_float_to_uint8_t((std::abs(player.position.x) - x_pos) * 100.0f);
-				uint8_t y_pos_decimal = absolute_float_to_uint8_t((std::abs(player.position.y) - y_pos) * 100.0f);
-				uint8_t z_pos_decimal = absolute_float_to_uint8_t((std::abs(player.position.z) - z_pos) * 100.0f);
-
-				//queue the current player position:
-				c->send(x_pos_sign);
-				c->send(x_pos);
-				c->send(x_pos_decimal);
-				c->send(y_pos_sign);
-				c->send(y_pos);
-				c->send(y_pos_decimal);
-				c->send(z_pos_sign);
-				c->send(z_pos);
-				c->send(z_pos_decimal);
-
-				//TODO: queue the current player rotation in euler angles
-			}
-
-			if (player_unused.id == it_player) {
-				//send info that you are it
-				std::string it_message = "You are it! Tag someone!";
-
-				//let the client know which player it is:
-				c->send('m');
-				c->send(uint8_t(it_message.size() >> 16));
-				c->send(uint8_t((it_message.size() >> 8) % 256));
-				c->send(uint8_t(it_message.size() % 256));
-				c->send_buffer.insert(c->send_buffer.end(), it_message.begin(), it_message.end());
+		//------ encode: build and serialize each client's view of this tick ------
+		auto encode_start = std::chrono::steady_clock::now();
+
+		//baseline for a client's delta is the last view it acknowledged, if that is still in its history:
+		auto baseline_tick = [&tick](PlayerInfo const &player) -> uint32_t {
+			if (player.acked_tick == NoBaseline || tick - player.acked_tick >= SnapshotHistory) return NoBaseline;
+			if (player.views[player.acked_tick % SnapshotHistory].tick != player.acked_tick) return NoBaseline;
+			return player.acked_tick;
+		};
+
+		//what a client was sent at a given tick:
+		auto sent_view = [&history](PlayerInfo const &player, uint32_t t) -> Snapshot const & {
+			uint32_t slot = t % SnapshotHistory;
+			return (player.whole_views[slot] ? history[slot] : player.views[slot]);
+		};
+
+		std::unordered_map< uint32_t, Connection::SharedData > whole_messages; //encodings of the whole snapshot, by baseline tick
+		std::vector< std::pair< uint32_t, bool > > nearby; //(id, is within near_radius) of players near a client
+		std::vector< uint8_t > marks(world.entries.size(), 0); //(scratch) nearby players by index in world: 1 = far, 2 = near
+		for (auto &[id, player] : players) {
+			(void)id; //work around "unused variable" warning on whatever version of g++ github actions is running
+			uint32_t slot = tick % SnapshotHistory;
+			Snapshot &view = player.views[slot];
+			view.tick = tick;
+			view.entries.clear();
+
+			//the view this client was sent last tick (if any):
+			Snapshot const *previous = nullptr;
+			if (tick > 0 && player.views[(tick - 1) % SnapshotHistory].tick == tick - 1) previous = &sent_view(player, tick - 1);
+
+			uint32_t baseline = baseline_tick(player);
+			Snapshot const *baseline_view = (baseline == NoBaseline ? nullptr : &sent_view(player, baseline));
+
+			//(far players are refreshed on different ticks for different clients, to spread out the work)
+			bool refresh_far = ((tick + uint32_t(player.id)) % FarInterval == 0);
+
+			//find nearby players (via the grid, so this is proportional to how many are nearby, not to how many there are):
+			nearby.clear();
+			bool all_near = true;
+			grid.query(glm::vec2(player.position), far_radius, [&](uint32_t other, glm::vec2 const &, float distance2){
+				if (other >= world_index.size() || world_index[other] == uint32_t(-1)) return;
+				bool near = (distance2 <= near_radius * near_radius);
+				nearby.emplace_back(other, near);
+				all_near = all_near && near;
+			});
+
+			if (nearby.size() == world.entries.size() && (all_near || refresh_far || !previous)) {
+				//every player, all up to date -- so the view is just this tick's snapshot:
+				player.whole_views[slot] = true;
+				if (baseline == NoBaseline || player.whole_views[baseline % SnapshotHistory]) {
+					//...and clients whose baselines were also whole can share one encoding:
+					auto &message = whole_messages[baseline];
+					if (!message) {
+						auto bytes = std::make_shared< std::vector< char > >();
+						world.encode(baseline_view, bytes.get());
+						message = bytes;
+					}
+					player.snapshot_message = message;
+				} else {
+					auto bytes = std::make_shared< std::vector< char > >();
+					world.encode(baseline_view, bytes.get());
+					player.snapshot_message = bytes;
+				}
+				continue;
+			}
+
+			player.whole_views[slot] = false;
+			//put nearby players in id order:
+			if (nearby.size() * 8 < world.entries.size()) {
+				std::sort(nearby.begin(), nearby.end());
 			} else {
-				//send info for who is it
-				std::string it_message = "";
-				if (it_player == 1)
-					it_message.append("Red");
-				else if (it_player == 2)
-					it_message.append("Green");
-				else if (it_player == 3)
-					it_message.append("Blue");
-				else if (it_player == 4)
-					it_message.append("Purple");
-				it_message.append(" is it!");
-
-				//let the client know which player it is:
-				c->send('m');
-				c->send(uint8_t(it_message.size() >> 16));
-				c->send(uint8_t((it_message.size() >> 8) % 256));
-				c->send(uint8_t(it_message.size() % 256));
-				c->send_buffer.insert(c->send_buffer.end(), it_message.begin(), it_message.end());
-			}
-			
+				//(when a good fraction of everyone is nearby, a pass over the snapshot -- which is in id order -- beats sorting)
+				for (auto const &[other, near] : nearby) {
+					marks[world_index[other]] = (near ? 2 : 1);
+				}
+				nearby.clear();
+				for (uint32_t i = 0; i < marks.size(); ++i) {
+					if (marks[i] == 0) continue;
+					nearby.emplace_back(world.entries[i].id, marks[i] == 2);
+					marks[i] = 0;
+				}
+			}
+			//(walk the previous view alongside, since both are sorted by id)
+			std::vector< Snapshot::Entry > const &before = (previous ? previous->entries : view.entries);
+			auto sent = before.begin();
+			for (auto const &[other, near] : nearby) {
+				if (!near && !refresh_far && previous) {
+					//far away, so (if the client already has it) repeat what it was last sent, which costs nothing in the delta:
+					while (sent != before.end() && sent->id < other) ++sent;
+					if (sent != before.end() && sent->id == other) {
+						view.entries.emplace_back(*sent);
+						continue;
+					}
+				}
+				view.entries.emplace_back(world.entries[world_index[other]]);
+			}
+
+			auto bytes = std::make_shared< std::vector< char > >();
+			view.encode(baseline_view, bytes.get());
+			player.snapshot_message = bytes;
 		}
 
+		//info about who is it (one version for the player who is it, one for everyone else):
+		static Connection::SharedData const you_are_it_message = make_text_message("You are it! Tag someone!");
+		std::string it_color = "";
+		if (it_player == 1)
+			it_color = "Red";
+		else if (it_player == 2)
+			it_color = "Green";
+		else if (it_player == 3)
+			it_color = "Blue";
+		else if (it_player == 4)
+			it_color = "Purple";
+		Connection::SharedData who_is_it_message = make_text_message(it_color + " is it!");
+
+		profiler.add(TickProfiler::Encode, std::chrono::duration< double >(std::chrono::steady_clock::now() - encode_start).count());
+
+		//------ fan-out: queue the shared bytes on every connection ------
+		auto fan_out_start = std::chrono::steady_clock::now();
+		for (auto &[id, player] : players) {
+			//snapshots go over UDP once linked (where the latest one wins), unless too big for one packet:
+			Connection::SharedData const &snapshot_message = player.snapshot_message;
+			if (!(player.udp && player.udp->send_unreliable(snapshot_message->data(), snapshot_message->size()))) {
+				server.send_shared(id, snapshot_message);
+			}
+			//tell the client where its inputs have taken it (it only needs the newest, so this can go unreliably):
+			if (player.last_input != player.reported_input) {
+				uint8_t message[ReconcileBytes];
+				message[0] = 'r';
+				put_uint32(player.last_input, message + 1);
+				glm::u16vec3 position = quantize_position(player.position);
+				put_uint16(position.x, message + 5);
+				put_uint16(position.y, message + 7);
+				put_uint16(position.z, message + 9);
+				if (!(player.udp && player.udp->send_unreliable(message, ReconcileBytes))) {
+					server.send_raw(id, message, ReconcileBytes);
+				}
+				player.reported_input = player.last_input;
+			}
+			//(the client keeps showing the last message, so only send it when who is it changes)
+			if (player.it_player_sent != it_player) {
+				Connection::SharedData const &message = (player.id == it_player ? you_are_it_message : who_is_it_message);
+				if (player.udp) {
+					player.udp->send_reliable(TextChannel, message->data(), message->size());
+				} else {
+					server.send_shared(id, message);
+				}
+				player.it_player_sent = it_player;
+			}
+		}
+		profiler.add(TickProfiler::FanOut, std::chrono::duration< double >(std::chrono::steady_clock::now() - fan_out_start).count());
+
+		//------ send: push this tick's messages to the sockets (or I/O threads) right away ------
+		// (note: this also handles anything that arrived meanwhile, which is counted as receive time as well)
+		{
+			TickProfiler::Scope scope(profiler, TickProfiler::Send);
+			udp_server.poll(on_udp_event, 0.0);
+			server.poll(on_tcp_event, 0.0);
+		}
+
+		//------ profiling: how long the tick took and what is still waiting to go out ------
+		{
+			size_t connections = 0, total = 0, max = 0;
+			server.sending_bytes(&connections, &total, &max);
+			profiler.queue_depths(connections, total, max);
+		}
+		auto tick_end = std::chrono::steady_clock::now();
+		profiler.end_tick(tick_late, std::chrono::duration< double >(tick_end - tick_deadline).count(), ServerTick);
+		if (stats_interval > 0.0 && std::chrono::duration< double >(tick_end - last_report).count() >= stats_interval) {
+			double elapsed = std::chrono::duration< double >(tick_end - last_report).count();
+			profiler.report(stats_out.is_open() ? static_cast< std::ostream & >(stats_out) : std::cout, elapsed);
+			last_report = tick_end;
+		}
+
+		tick += 1;
+
 	}
 
 	return 0;
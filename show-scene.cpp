@@ -120,6 +120,13 @@ int main(int argc, char **argv) {
 				drawable.pipeline.type = mesh.type;
 				drawable.pipeline.start = mesh.start;
 				drawable.pipeline.count = mesh.count;
+				drawable.pipeline.index_type = mesh.index_type;
+				drawable.pipeline.index_start = mesh.index_start;
+				drawable.pipeline.index_count = mesh.index_count;
+				drawable.pipeline.position_scale = mesh.position_scale;
+				drawable.pipeline.position_offset = mesh.position_offset;
+				drawable.pipeline.min = mesh.min;
+				drawable.pipeline.max = mesh.max;
 
 			});
 		} catch (std::exception &e) {
@@ -0,0 +1,37 @@
+//weld-meshes turns a triangle-soup mesh file (as written by scenes/export-meshes.py) into an indexed one:
+// identical vertices within each mesh are stored once, and triangles refer to them by index.
+// (MeshBuffer loads either variant; the indexed one is smaller and lets the GPU re-use shaded vertices)
+
+#include "MeshFile.hpp"
+
+#include <iostream>
+
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		std::cerr << "Usage:\n\t" << argv[0] << " <in.pnct> <out.pnct>\n(in and out may be the same file)" << std::endl;
+		return 1;
+	}
+
+	try {
+		MeshFile file(argv[1]);
+
+		size_t before_vertices = file.vertices.size();
+		size_t before_bytes = before_vertices * sizeof(MeshFile::Vertex) + file.indices.size() * file.index_size();
+
+		file.weld();
+
+		size_t after_bytes = file.vertices.size() * sizeof(MeshFile::Vertex) + file.indices.size() * file.index_size();
+
+		file.save(argv[2]);
+
+		std::cout << "Welded " << file.meshes.size() << " meshes in '" << argv[1] << "': "
+		          << before_vertices << " -> " << file.vertices.size() << " vertices, "
+		          << file.indices.size() << " indices (" << file.index_size() * 8 << "-bit); "
+		          << before_bytes << " -> " << after_bytes << " bytes of vertex+index data." << std::endl;
+	} catch (std::exception &e) {
+		std::cerr << "ERROR: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}